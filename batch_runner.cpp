@@ -0,0 +1,193 @@
+// cppimport
+#include <pybind11/pybind11.h>
+#include <pybind11/stl.h>
+#include <pybind11/stl_bind.h>
+#include "mcts.cpp"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace py = pybind11;
+
+struct Scenario
+{
+    Environment env;
+    Config config;
+    int obs_radius = 5;
+    int max_steps = 64;
+};
+
+struct EpisodeResult
+{
+    double csr = 0;
+    double isr = 0;
+    int episode_length = 0;
+    double time_per_move_ms = 0;
+};
+
+struct BatchResult
+{
+    std::vector<EpisodeResult> episodes;
+    double csr = 0;
+    double isr = 0;
+    double episode_length = 0;
+    double time_per_move_ms = 0;
+    double wall_time_s = 0;
+};
+
+// Runs complete episodes for many scenarios on a fixed set of worker threads.
+// Every worker keeps one search across its episodes and takes the next
+// scenario from a shared counter, so long and short episodes balance out.
+class BatchRunner
+{
+    int num_workers;
+    unsigned threads_per_search;
+
+    static EpisodeResult run_episode(MonteCarloTreeSearch& mcts, const Scenario& scenario)
+    {
+        Config cfg = scenario.config;
+        cfg.render = false;
+        mcts.set_config(cfg);
+        mcts.set_env(scenario.env, scenario.obs_radius);
+        Environment truth = scenario.env;
+        EpisodeResult result;
+        double search_ms = 0;
+        while (!truth.all_done() && result.episode_length < scenario.max_steps)
+        {
+            const auto start = std::chrono::steady_clock::now();
+            const auto actions = mcts.act();
+            search_ms += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+            truth.step(actions);
+            result.episode_length++;
+        }
+        const int num_agents = truth.get_num_agents();
+        result.csr = truth.all_done() ? 1 : 0;
+        result.isr = num_agents > 0 ? static_cast<double>(truth.get_num_done()) / num_agents : 1;
+        result.time_per_move_ms = result.episode_length > 0 ? search_ms / result.episode_length : 0;
+        return result;
+    }
+
+public:
+    // num_workers_ <= 0 uses one worker per hardware thread; otherwise every
+    // search gets an equal share of the hardware threads. The worker itself
+    // executes tasks inside parallel_for(), so it counts towards that share
+    // and the search pool only gets the other threads_per_search - 1.
+    explicit BatchRunner(const int num_workers_ = 0)
+    {
+        const int hardware = std::max(1u, std::thread::hardware_concurrency());
+        num_workers = num_workers_ > 0 ? num_workers_ : hardware;
+        threads_per_search = std::max(1, hardware / num_workers);
+    }
+
+    BatchResult run(const std::vector<Scenario>& scenarios) const
+    {
+        BatchResult result;
+        result.episodes.resize(scenarios.size());
+        const auto start = std::chrono::steady_clock::now();
+        std::atomic<size_t> next = 0;
+        std::exception_ptr error;
+        std::mutex error_mutex;
+        const auto worker = [&]()
+        {
+            std::unique_ptr<MonteCarloTreeSearch> mcts;
+            for (size_t k = next++; k < scenarios.size(); k = next++)
+            {
+                try
+                {
+                    if (!mcts)
+                    {
+                        mcts = std::make_unique<MonteCarloTreeSearch>(threads_per_search - 1);
+                    }
+                    result.episodes[k] = run_episode(*mcts, scenarios[k]);
+                }
+                catch (...)
+                {
+                    const std::lock_guard<std::mutex> lock(error_mutex);
+                    if (!error)
+                    {
+                        error = std::current_exception();
+                    }
+                    next = scenarios.size();
+                }
+            }
+        };
+        const int num_threads = std::min<int>(num_workers, scenarios.size());
+        std::vector<std::thread> threads;
+        for (int i = 1; i < num_threads; i++)
+        {
+            threads.emplace_back(worker);
+        }
+        worker();
+        for (auto& thread : threads)
+        {
+            thread.join();
+        }
+        if (error)
+        {
+            std::rethrow_exception(error);
+        }
+        result.wall_time_s = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        for (const auto& episode : result.episodes)
+        {
+            result.csr += episode.csr;
+            result.isr += episode.isr;
+            result.episode_length += episode.episode_length;
+            result.time_per_move_ms += episode.time_per_move_ms;
+        }
+        if (!result.episodes.empty())
+        {
+            const double n = result.episodes.size();
+            result.csr /= n;
+            result.isr /= n;
+            result.episode_length /= n;
+            result.time_per_move_ms /= n;
+        }
+        return result;
+    }
+
+    int get_num_workers() const
+    {
+        return num_workers;
+    }
+};
+
+PYBIND11_MODULE(batch_runner, m) {
+    py::class_<Scenario>(m, "Scenario")
+            .def(py::init<>())
+            .def_readwrite("env", &Scenario::env)
+            .def_readwrite("config", &Scenario::config)
+            .def_readwrite("obs_radius", &Scenario::obs_radius)
+            .def_readwrite("max_steps", &Scenario::max_steps)
+            ;
+    py::class_<EpisodeResult>(m, "EpisodeResult")
+            .def_readonly("csr", &EpisodeResult::csr)
+            .def_readonly("isr", &EpisodeResult::isr)
+            .def_readonly("episode_length", &EpisodeResult::episode_length)
+            .def_readonly("time_per_move_ms", &EpisodeResult::time_per_move_ms)
+            ;
+    py::class_<BatchResult>(m, "BatchResult")
+            .def_readonly("episodes", &BatchResult::episodes)
+            .def_readonly("csr", &BatchResult::csr)
+            .def_readonly("isr", &BatchResult::isr)
+            .def_readonly("episode_length", &BatchResult::episode_length)
+            .def_readonly("time_per_move_ms", &BatchResult::time_per_move_ms)
+            .def_readonly("wall_time_s", &BatchResult::wall_time_s)
+            ;
+    py::class_<BatchRunner>(m, "BatchRunner")
+            .def(py::init<int>(), py::arg("num_workers") = 0)
+            .def("run", &BatchRunner::run, py::call_guard<py::gil_scoped_release>())
+            .def("get_num_workers", &BatchRunner::get_num_workers)
+            ;
+}
+
+/*
+<%
+cfg['extra_compile_args'] = ['-std=c++17']
+setup_pybind11(cfg)
+%>
+*/
@@ -0,0 +1,440 @@
+#include "mcts.cpp"
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <random>
+#include <string>
+
+// Microbenchmarks for the search hot paths. Every case runs its operation in
+// growing batches until a batch takes at least min_seconds, then reports the
+// time and heap allocations per operation and the resulting throughput.
+// Cases that grow a search tree start every operation from a fresh tree, set
+// up outside the timed region, so the numbers do not drift with the batch size.
+// Usage: MCTS_bench [name filter] [min seconds per case]
+
+static std::atomic<uint64_t> num_allocations{0};
+
+#if defined(__GNUC__) && !defined(__clang__)
+// the replacements below pair malloc/aligned_alloc with free on purpose
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
+
+void* operator new(std::size_t size)
+{
+    num_allocations.fetch_add(1, std::memory_order_relaxed);
+    if (void* p = std::malloc(size ? size : 1))
+    {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+
+void* operator new[](std::size_t size)
+{
+    return operator new(size);
+}
+
+void* operator new(std::size_t size, std::align_val_t align)
+{
+    num_allocations.fetch_add(1, std::memory_order_relaxed);
+    const std::size_t alignment = static_cast<std::size_t>(align);
+    if (void* p = std::aligned_alloc(alignment, (size + alignment - 1) / alignment * alignment))
+    {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept
+{
+    std::free(p);
+}
+
+void operator delete[](void* p) noexcept
+{
+    std::free(p);
+}
+
+void operator delete(void* p, std::size_t) noexcept
+{
+    std::free(p);
+}
+
+void operator delete[](void* p, std::size_t) noexcept
+{
+    std::free(p);
+}
+
+void operator delete(void* p, std::align_val_t) noexcept
+{
+    std::free(p);
+}
+
+void operator delete(void* p, std::size_t, std::align_val_t) noexcept
+{
+    std::free(p);
+}
+
+class BenchSearch : public MonteCarloTreeSearch
+{
+public:
+    using MonteCarloTreeSearch::MonteCarloTreeSearch;
+    using MonteCarloTreeSearch::single_simulation;
+    using MonteCarloTreeSearch::lockstep_simulation;
+    using MonteCarloTreeSearch::selection;
+    using MonteCarloTreeSearch::batch_loop;
+    using MonteCarloTreeSearch::tree_parallelization_loop;
+    using MonteCarloTreeSearch::safe_insert_node;
+    using MonteCarloTreeSearch::release_subtree;
+};
+
+struct Measurement
+{
+    double ns_per_op;
+    double allocs_per_op;
+    double ops_per_second;
+};
+
+struct MapSpec
+{
+    int size;
+    int num_agents;
+};
+
+constexpr int obs_radius = 2;
+
+// Random map with a wall border as thick as the observation radius (like the
+// padding pogema adds) and about 20% obstacles inside.
+Environment make_env(const MapSpec& spec, const unsigned seed)
+{
+    std::mt19937 rng(seed);
+    Environment env;
+    env.create_grid(spec.size, spec.size);
+    std::vector<uint8_t> used(spec.size * spec.size, 0);
+    for (int i = 0; i < spec.size; i++)
+    {
+        for (int j = 0; j < spec.size; j++)
+        {
+            const bool border = i < obs_radius || j < obs_radius || i >= spec.size - obs_radius || j >= spec.size - obs_radius;
+            if (border || rng() % 5 == 0)
+            {
+                env.add_obstacle(i, j);
+                used[i * spec.size + j] = 1;
+            }
+        }
+    }
+    const auto free_cell = [&]()
+    {
+        while (true)
+        {
+            const int c = rng() % (spec.size * spec.size);
+            if (!used[c])
+            {
+                used[c] = 1;
+                return std::make_pair(c / spec.size, c % spec.size);
+            }
+        }
+    };
+    for (int a = 0; a < spec.num_agents; a++)
+    {
+        const auto start = free_cell();
+        const auto goal = free_cell();
+        env.add_agent(start.first, start.second, goal.first, goal.second);
+    }
+    return env;
+}
+
+Config bench_config()
+{
+    Config cfg;
+    cfg.render = false;
+    cfg.seed = 1;
+    return cfg;
+}
+
+template<typename F>
+Measurement measure(F&& op, const double min_seconds)
+{
+    op();
+    size_t iterations = 1;
+    while (true)
+    {
+        const uint64_t allocations_before = num_allocations.load(std::memory_order_relaxed);
+        const auto start = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < iterations; i++)
+        {
+            op();
+        }
+        const double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        const uint64_t allocations = num_allocations.load(std::memory_order_relaxed) - allocations_before;
+        if (elapsed >= min_seconds)
+        {
+            return {elapsed * 1e9 / iterations, static_cast<double>(allocations) / iterations, iterations / elapsed};
+        }
+        const double target = elapsed > 0 ? iterations * min_seconds * 1.2 / elapsed : iterations * 100.0;
+        iterations = std::max(iterations * 2, std::min(static_cast<size_t>(target), iterations * 100));
+    }
+}
+
+// Like measure(), but runs setup before every operation and times only op.
+template<typename S, typename F>
+Measurement measure_fresh(S&& setup, F&& op, const double min_seconds)
+{
+    setup();
+    op();
+    size_t iterations = 1;
+    while (true)
+    {
+        uint64_t allocations = 0;
+        double elapsed = 0;
+        for (size_t i = 0; i < iterations; i++)
+        {
+            setup();
+            const uint64_t allocations_before = num_allocations.load(std::memory_order_relaxed);
+            const auto start = std::chrono::steady_clock::now();
+            op();
+            elapsed += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            allocations += num_allocations.load(std::memory_order_relaxed) - allocations_before;
+        }
+        if (elapsed >= min_seconds)
+        {
+            return {elapsed * 1e9 / iterations, static_cast<double>(allocations) / iterations, iterations / elapsed};
+        }
+        const double target = elapsed > 0 ? iterations * min_seconds * 1.2 / elapsed : iterations * 100.0;
+        iterations = std::max(iterations * 2, std::min(static_cast<size_t>(target), iterations * 100));
+    }
+}
+
+void report(const std::string& name, const MapSpec& spec, const Measurement& m, const double items_per_op = 0, const char* unit = "")
+{
+    const std::string map = std::to_string(spec.size) + "x" + std::to_string(spec.size) + "/" + std::to_string(spec.num_agents);
+    std::printf("%-28s %-10s %14.1f ns/op %10.2f allocs/op", name.c_str(), map.c_str(), m.ns_per_op, m.allocs_per_op);
+    if (items_per_op > 0)
+    {
+        std::printf(" %14.0f %s", m.ops_per_second * items_per_op, unit);
+    }
+    std::printf("\n");
+    std::fflush(stdout);
+}
+
+int main(int argc, char* argv[])
+{
+    const std::string filter = argc > 1 ? argv[1] : "";
+    const double min_seconds = argc > 2 ? std::atof(argv[2]) : 0.2;
+    const auto enabled = [&](const std::string& name)
+    {
+        return filter.empty() || name.find(filter) != std::string::npos;
+    };
+    const std::vector<MapSpec> specs = {{16, 4}, {32, 16}, {64, 64}};
+    for (const auto& spec : specs)
+    {
+        const Environment base = make_env(spec, spec.size * 31 + spec.num_agents);
+
+        if (enabled("env_step_back"))
+        {
+            Environment env = base;
+            env.set_seed(1);
+            std::vector<std::vector<int>> joint_actions(64);
+            for (auto& actions : joint_actions)
+            {
+                env.sample_actions(actions, 5, true, false);
+            }
+            size_t k = 0;
+            report("env_step_back", spec, measure([&]()
+            {
+                env.step(joint_actions[k++ % joint_actions.size()]);
+                env.step_back();
+            }, min_seconds));
+        }
+
+        if (enabled("env_sample_actions"))
+        {
+            Environment env = base;
+            env.set_seed(1);
+            std::vector<int> actions;
+            report("env_sample_actions", spec, measure([&]()
+            {
+                env.sample_actions(actions, 5, true, true);
+            }, min_seconds));
+        }
+
+        if (enabled("env_check_action"))
+        {
+            Environment env = base;
+            size_t k = 0;
+            int legal = 0;
+            report("env_check_action", spec, measure([&]()
+            {
+                legal += env.check_action(k / 5 % spec.num_agents, k % 5, true);
+                k++;
+            }, min_seconds));
+            if (legal < 0)
+            {
+                std::printf("%d\n", legal);
+            }
+        }
+
+        if (enabled("single_simulation"))
+        {
+            BenchSearch mcts(1);
+            mcts.set_config(bench_config());
+            mcts.set_env(base, obs_radius);
+            report("single_simulation", spec, measure([&]()
+            {
+                mcts.single_simulation(0);
+            }, min_seconds), 1, "rollouts/s");
+        }
+
+        if (enabled("single_simulation_replan"))
+        {
+            BenchSearch mcts(1);
+            Config cfg = bench_config();
+            cfg.use_replansim = true;
+            mcts.set_config(cfg);
+            mcts.set_env(base, obs_radius);
+            report("single_simulation_replan", spec, measure([&]()
+            {
+                mcts.single_simulation(0);
+            }, min_seconds), 1, "rollouts/s");
+        }
+
+        if (enabled("single_simulation_truncated"))
+        {
+            BenchSearch mcts(1);
+            Config cfg = bench_config();
+            cfg.rollout_depth = 16;
+            cfg.rollout_stagnation_steps = 4;
+            cfg.rollout_value_coef = 1.0;
+            mcts.set_config(cfg);
+            mcts.set_env(base, obs_radius);
+            report("single_simulation_truncated", spec, measure([&]()
+            {
+                mcts.single_simulation(0);
+            }, min_seconds), 1, "rollouts/s");
+        }
+
+        if (enabled("lockstep_simulation"))
+        {
+            BenchSearch mcts(1);
+            Config cfg = bench_config();
+            cfg.multi_simulations = 8;
+            cfg.lockstep_rollouts = true;
+            mcts.set_config(cfg);
+            mcts.set_env(base, obs_radius);
+            report("lockstep_simulation", spec, measure([&]()
+            {
+                mcts.lockstep_simulation(0);
+            }, min_seconds), cfg.multi_simulations, "rollouts/s");
+        }
+
+        if (enabled("selection"))
+        {
+            BenchSearch mcts(1);
+            Config cfg = bench_config();
+            mcts.set_config(cfg);
+            mcts.set_env(base, obs_radius);
+            // one operation grows a fresh tree by selections_per_op iterations
+            constexpr int selections_per_op = 256;
+            Node* root = nullptr;
+            report("selection", spec, measure_fresh([&]()
+            {
+                if (root != nullptr)
+                {
+                    mcts.release_subtree(root);
+                }
+                root = mcts.safe_insert_node(nullptr, -1, 0, cfg.num_actions, 0);
+            }, [&]()
+            {
+                for (int i = 0; i < selections_per_op; i++)
+                {
+                    root->update_value(mcts.selection(root, {}, 0));
+                }
+            }, min_seconds), selections_per_op, "rollouts/s");
+            mcts.release_subtree(root);
+        }
+
+        if (enabled("batch_loop"))
+        {
+            BenchSearch mcts;
+            Config cfg = bench_config();
+            cfg.batch_size = 8;
+            cfg.num_expansions = 64;
+            mcts.set_config(cfg);
+            mcts.set_env(base, obs_radius);
+            std::vector<int> prev_actions;
+            report("batch_loop", spec, measure_fresh([&]()
+            {
+                mcts.set_env(base, obs_radius);
+            }, [&]()
+            {
+                mcts.batch_loop(prev_actions);
+            }, min_seconds), cfg.num_expansions * cfg.batch_size, "rollouts/s");
+        }
+
+        if (enabled("tree_parallelization_loop"))
+        {
+            BenchSearch mcts;
+            Config cfg = bench_config();
+            cfg.num_parallel_trees = 4;
+            cfg.num_expansions = 64;
+            mcts.set_config(cfg);
+            mcts.set_env(base, obs_radius);
+            std::vector<int> prev_actions;
+            report("tree_parallelization_loop", spec, measure_fresh([&]()
+            {
+                mcts.set_env(base, obs_radius);
+            }, [&]()
+            {
+                mcts.tree_parallelization_loop(prev_actions);
+            }, min_seconds), cfg.num_expansions * cfg.num_parallel_trees, "rollouts/s");
+        }
+
+        if (enabled("planner_update_path"))
+        {
+            // every observation is fed once, then the planner searches between
+            // the agents' start and goal cells, alternating direction
+            planner p(10000000, false);
+            p.set_map_size(spec.size, spec.size);
+            std::vector<std::pair<int, int>> obstacles;
+            for (int i = 0; i < spec.size; i++)
+            {
+                for (int j = 0; j < spec.size; j++)
+                {
+                    if (base.grid[i][j] == OBSTACLE)
+                    {
+                        obstacles.emplace_back(i, j);
+                    }
+                }
+            }
+            p.update_obstacles(obstacles, {}, {0, 0});
+            size_t k = 0;
+            report("planner_update_path", spec, measure([&]()
+            {
+                const size_t agent = k / 2 % spec.num_agents;
+                const auto& from = k % 2 ? base.goals[agent] : base.cur_positions[agent];
+                const auto& to = k % 2 ? base.cur_positions[agent] : base.goals[agent];
+                p.update_path(from, to);
+                p.get_next_node();
+                k++;
+            }, min_seconds));
+        }
+
+        if (enabled("replan_act"))
+        {
+            RePlan replan;
+            replan.init(spec.num_agents, obs_radius, true, 0.2, true, 10000000, 1, false);
+            replan.set_env(base);
+            int steps = 0;
+            report("replan_act", spec, measure([&]()
+            {
+                if (++steps == 64)
+                {
+                    replan.reset(base);
+                    steps = 0;
+                }
+                replan.act();
+            }, min_seconds), 1, "steps/s");
+        }
+    }
+}
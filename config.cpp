@@ -9,6 +9,8 @@ struct Config
     double gamma = 0.99;
     int num_actions = 5;
     int num_expansions = 1000;
+    int time_budget_us = 0;
+    bool time_budget_per_agent = false;
     double uct_c = 1.0;
     int steps_limit = 64;
     int multi_simulations = 1;
@@ -16,11 +18,22 @@ struct Config
     bool agents_as_obstacles = false;
     int batch_size = 1;
     int num_parallel_trees = 1;
+    int num_shared_workers = 1;
     bool render = true;
     double heuristic_coef = 0;
     bool use_replansim = false;
     bool retrieve_depth_statisticts = false;
     bool first_step_stats = false;
+    int seed = -1;
+    std::string distance_field_dir = "";
+    bool collect_stats = false;
+    bool use_transpositions = false;
+    int transposition_table_log2 = 18;
+    bool use_decoupled_uct = false;
+    bool lockstep_rollouts = false;
+    int rollout_depth = 0;
+    int rollout_stagnation_steps = 0;
+    double rollout_value_coef = 0;
 };
 
 PYBIND11_MODULE(config, m) {
@@ -29,6 +42,8 @@ PYBIND11_MODULE(config, m) {
         .def_readwrite("gamma", &Config::gamma)
         .def_readwrite("num_actions", &Config::num_actions)
         .def_readwrite("num_expansions", &Config::num_expansions)
+        .def_readwrite("time_budget_us", &Config::time_budget_us)
+        .def_readwrite("time_budget_per_agent", &Config::time_budget_per_agent)
         .def_readwrite("uct_c", &Config::uct_c)
         .def_readwrite("steps_limit", &Config::steps_limit)
         .def_readwrite("multi_simulations", &Config::multi_simulations)
@@ -36,11 +51,22 @@ PYBIND11_MODULE(config, m) {
         .def_readwrite("agents_as_obstacles", &Config::agents_as_obstacles)
         .def_readwrite("batch_size", &Config::batch_size)
         .def_readwrite("num_parallel_trees", &Config::num_parallel_trees)
+        .def_readwrite("num_shared_workers", &Config::num_shared_workers)
         .def_readwrite("render", &Config::render)
         .def_readwrite("heuristic_coef", &Config::heuristic_coef)
         .def_readwrite("use_replansim", &Config::use_replansim)
         .def_readwrite("retrieve_depth_statisticts", &Config::retrieve_depth_statisticts)
         .def_readwrite("first_step_stats", &Config::first_step_stats)
+        .def_readwrite("seed", &Config::seed)
+        .def_readwrite("distance_field_dir", &Config::distance_field_dir)
+        .def_readwrite("collect_stats", &Config::collect_stats)
+        .def_readwrite("use_transpositions", &Config::use_transpositions)
+        .def_readwrite("transposition_table_log2", &Config::transposition_table_log2)
+        .def_readwrite("use_decoupled_uct", &Config::use_decoupled_uct)
+        .def_readwrite("lockstep_rollouts", &Config::lockstep_rollouts)
+        .def_readwrite("rollout_depth", &Config::rollout_depth)
+        .def_readwrite("rollout_stagnation_steps", &Config::rollout_stagnation_steps)
+        .def_readwrite("rollout_value_coef", &Config::rollout_value_coef)
         ;
 }
 
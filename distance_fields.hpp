@@ -0,0 +1,337 @@
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "work_stealing_pool.hpp"
+
+// Shortest-path distances from every cell to a goal cell over the static
+// obstacles, one flat field per goal. Fields survive set_map() as long as the
+// map does not change, so goals that repeat across episodes are computed once.
+// prepare() is the only writer; call it while no search is reading the fields.
+//
+// Fields can also be saved to and loaded from a store file per map. The file
+// holds a header, an index of (goal cell, offset) entries and the fields at
+// 64-byte aligned offsets, in native byte order. load() maps it read-only and
+// serves the fields straight from the mapping.
+class DistanceFieldCache
+{
+    static constexpr char file_magic[8] = {'M', 'C', 'T', 'S', 'D', 'F', 'C', '\0'};
+    static constexpr uint32_t file_version = 1;
+
+    struct FileHeader
+    {
+        char magic[8];
+        uint32_t version;
+        uint32_t height;
+        uint32_t width;
+        uint32_t num_fields;
+        uint64_t map_hash;
+    };
+
+    struct FileEntry
+    {
+        int32_t goal;
+        uint32_t reserved;
+        uint64_t offset;
+    };
+
+    struct Mapping
+    {
+        void* addr;
+        size_t bytes;
+
+        Mapping(void* addr_, const size_t bytes_) : addr(addr_), bytes(bytes_) {}
+        Mapping(const Mapping&) = delete;
+        Mapping& operator=(const Mapping&) = delete;
+
+        ~Mapping()
+        {
+            munmap(addr, bytes);
+        }
+    };
+
+    int height = 0;
+    int width = 0;
+    uint64_t map_hash = 0;
+    std::vector<uint8_t> blocked;
+    std::unordered_map<int, const uint16_t*> fields;
+    std::vector<std::unique_ptr<uint16_t[]>> computed;
+    std::vector<std::unique_ptr<Mapping>> mappings;
+
+    int cell(const std::pair<int, int>& pos) const
+    {
+        if (pos.first < 0 || pos.first >= height || pos.second < 0 || pos.second >= width)
+        {
+            return -1;
+        }
+        return pos.first * width + pos.second;
+    }
+
+    void compute(const int goal, uint16_t* field) const
+    {
+        static constexpr int deltas[4][2] = {{-1, 0}, {1, 0}, {0, -1}, {0, 1}};
+        std::fill(field, field + height * width, unreachable);
+        if (blocked[goal])
+        {
+            return;
+        }
+        std::vector<int> queue;
+        queue.reserve(height * width);
+        queue.push_back(goal);
+        field[goal] = 0;
+        for (size_t head = 0; head < queue.size(); head++)
+        {
+            const int c = queue[head];
+            const int i = c / width, j = c % width;
+            for (const auto& d : deltas)
+            {
+                const int ni = i + d[0], nj = j + d[1];
+                if (ni < 0 || ni >= height || nj < 0 || nj >= width)
+                {
+                    continue;
+                }
+                const int n = ni * width + nj;
+                if (!blocked[n] && field[n] == unreachable)
+                {
+                    field[n] = field[c] + 1;
+                    queue.push_back(n);
+                }
+            }
+        }
+    }
+
+public:
+    static constexpr uint16_t unreachable = UINT16_MAX;
+
+    // Switches to the map of grid (non-zero cells are obstacles), dropping every
+    // field if it differs from the current one.
+    void set_map(const std::vector<std::vector<int>>& grid)
+    {
+        const int height_ = grid.size();
+        const int width_ = grid.empty() ? 0 : grid[0].size();
+        std::vector<uint8_t> blocked_(height_ * width_);
+        for (int i = 0; i < height_; i++)
+        {
+            for (int j = 0; j < width_; j++)
+            {
+                blocked_[i * width_ + j] = grid[i][j] != 0;
+            }
+        }
+        if (height_ != height || width_ != width || blocked_ != blocked)
+        {
+            height = height_;
+            width = width_;
+            blocked.swap(blocked_);
+            fields.clear();
+            computed.clear();
+            mappings.clear();
+            // FNV-1a over the dimensions and the obstacle mask
+            map_hash = 14695981039346656037ULL;
+            const auto mix = [this](const uint64_t byte)
+            {
+                map_hash = (map_hash ^ byte) * 1099511628211ULL;
+            };
+            for (int k = 0; k < 4; k++)
+            {
+                mix((static_cast<uint32_t>(height) >> (8 * k)) & 0xff);
+                mix((static_cast<uint32_t>(width) >> (8 * k)) & 0xff);
+            }
+            for (const uint8_t b : blocked)
+            {
+                mix(b);
+            }
+        }
+    }
+
+    // Computes the missing fields for goals, in parallel on pool when given.
+    void prepare(const std::vector<std::pair<int, int>>& goals, WorkStealingPool* pool = nullptr)
+    {
+        std::vector<std::pair<int, uint16_t*>> missing;
+        for (const auto& goal : goals)
+        {
+            const int c = cell(goal);
+            if (c < 0 || fields.count(c) > 0)
+            {
+                continue;
+            }
+            computed.push_back(std::make_unique<uint16_t[]>(height * width));
+            fields[c] = computed.back().get();
+            missing.emplace_back(c, computed.back().get());
+        }
+        const auto task = [&](const int k)
+        {
+            compute(missing[k].first, missing[k].second);
+        };
+        if (pool != nullptr)
+        {
+            pool->parallel_for(missing.size(), task);
+        }
+        else
+        {
+            for (size_t k = 0; k < missing.size(); k++)
+            {
+                task(k);
+            }
+        }
+    }
+
+    // Field of goal, or nullptr if prepare() has not computed it.
+    const uint16_t* get(const std::pair<int, int>& goal) const
+    {
+        const auto it = fields.find(cell(goal));
+        return it == fields.end() ? nullptr : it->second;
+    }
+
+    bool contains_all(const std::vector<std::pair<int, int>>& goals) const
+    {
+        for (const auto& goal : goals)
+        {
+            if (get(goal) == nullptr)
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // Store file of the current map inside directory.
+    std::string store_path(const std::string& directory) const
+    {
+        char name[32];
+        std::snprintf(name, sizeof(name), "%016llx.dfc", static_cast<unsigned long long>(map_hash));
+        return directory + "/" + name;
+    }
+
+    // Maps the store file at path and adds the fields it has for goals not yet
+    // cached. Returns false if the file is missing or belongs to another map
+    // or format version.
+    bool load(const std::string& path)
+    {
+        const int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+        {
+            return false;
+        }
+        struct stat st;
+        void* addr = MAP_FAILED;
+        if (fstat(fd, &st) == 0 && static_cast<size_t>(st.st_size) >= sizeof(FileHeader))
+        {
+            addr = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        }
+        close(fd);
+        if (addr == MAP_FAILED)
+        {
+            return false;
+        }
+        auto mapping = std::make_unique<Mapping>(addr, st.st_size);
+        const auto* base = static_cast<const unsigned char*>(addr);
+        FileHeader header;
+        std::memcpy(&header, base, sizeof(header));
+        const size_t field_bytes = size_t(height) * width * sizeof(uint16_t);
+        if (std::memcmp(header.magic, file_magic, sizeof(file_magic)) != 0 || header.version != file_version
+            || header.height != static_cast<uint32_t>(height) || header.width != static_cast<uint32_t>(width)
+            || header.map_hash != map_hash
+            || sizeof(FileHeader) + size_t(header.num_fields) * sizeof(FileEntry) > mapping->bytes)
+        {
+            return false;
+        }
+        bool used = false;
+        for (uint32_t k = 0; k < header.num_fields; k++)
+        {
+            FileEntry entry;
+            std::memcpy(&entry, base + sizeof(FileHeader) + k * sizeof(FileEntry), sizeof(entry));
+            if (entry.goal < 0 || entry.goal >= height * width || entry.offset % alignof(uint16_t) != 0
+                || entry.offset > mapping->bytes || mapping->bytes - entry.offset < field_bytes
+                || fields.count(entry.goal) > 0)
+            {
+                continue;
+            }
+            fields[entry.goal] = reinterpret_cast<const uint16_t*>(base + entry.offset);
+            used = true;
+        }
+        if (used)
+        {
+            mappings.push_back(std::move(mapping));
+        }
+        return true;
+    }
+
+    // Writes every cached field to path. The file is written next to it and
+    // renamed into place, so processes that mapped the old file keep reading it.
+    bool save(const std::string& path) const
+    {
+        const size_t field_bytes = size_t(height) * width * sizeof(uint16_t);
+        const auto align = [](const size_t offset)
+        {
+            return (offset + 63) / 64 * 64;
+        };
+        FileHeader header;
+        std::memcpy(header.magic, file_magic, sizeof(file_magic));
+        header.version = file_version;
+        header.height = height;
+        header.width = width;
+        header.num_fields = fields.size();
+        header.map_hash = map_hash;
+        std::vector<FileEntry> entries;
+        size_t offset = align(sizeof(FileHeader) + fields.size() * sizeof(FileEntry));
+        for (const auto& [goal, field] : fields)
+        {
+            entries.push_back(FileEntry{goal, 0, offset});
+            offset = align(offset + field_bytes);
+        }
+        const std::string tmp_path = path + ".tmp." + std::to_string(getpid());
+        {
+            std::ofstream out(tmp_path, std::ios::binary | std::ios::trunc);
+            out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+            out.write(reinterpret_cast<const char*>(entries.data()), entries.size() * sizeof(FileEntry));
+            size_t k = 0;
+            for (const auto& [goal, field] : fields)
+            {
+                (void)goal;
+                out.seekp(entries[k++].offset);
+                out.write(reinterpret_cast<const char*>(field), field_bytes);
+            }
+            if (!out)
+            {
+                std::remove(tmp_path.c_str());
+                return false;
+            }
+        }
+        return std::rename(tmp_path.c_str(), path.c_str()) == 0;
+    }
+
+    uint16_t distance(const uint16_t* field, const int i, const int j) const
+    {
+        if (field == nullptr || i < 0 || i >= height || j < 0 || j >= width)
+        {
+            return unreachable;
+        }
+        return field[i * width + j];
+    }
+
+    int get_height() const
+    {
+        return height;
+    }
+
+    int get_width() const
+    {
+        return width;
+    }
+
+    size_t size() const
+    {
+        return fields.size();
+    }
+};
@@ -2,25 +2,111 @@
 #include <pybind11/pybind11.h>
 #include <pybind11/stl.h>
 #include <pybind11/stl_bind.h>
+#include <pybind11/numpy.h>
 #include <vector>
+#include <stdexcept>
+#include <string>
 #include <iostream>
 #include <random>
 #include <chrono>
+#include "xoshiro.hpp"
 #define OBSTACLE 1
 #define TRAVERSABLE 0
 namespace py = pybind11;
 
+class EnvironmentBatch;
+
+// Agent state of an Environment, taken by save_state(). A snapshot that is
+// reused keeps its buffers, so saving into it allocates nothing.
+struct EnvironmentSnapshot
+{
+    std::vector<std::pair<int, int>> positions;
+    std::vector<bool> reached;
+    uint64_t hash = 0;
+};
+
 class Environment
 {
-    std::vector<std::vector<int>> made_actions;
+    friend class EnvironmentBatch;
+    std::vector<int> made_actions;
+    std::vector<int> applied;
+    std::vector<std::pair<int, int>> executed_pos;
     std::vector<bool> reached;
-    std::default_random_engine engine;
+    Xoshiro256 engine;
+    // bit a of legal_moves[c] is set when moves[a] from cell c stays on the map and off obstacles
+    std::vector<uint8_t> legal_moves;
+    int cell_offsets[5] = {0, 0, 0, 0, 0};
+    std::vector<int> occupancy;
+    std::vector<int> claims;
+    // Zobrist hash of the agent positions: xor of one key per (agent, cell).
+    // Reached flags are left out on purpose: an agent stops for good on its
+    // goal, so they follow from the positions, except for an agent that starts
+    // on its goal and is only marked by the first step().
+    uint64_t state_hash = 0;
+
+    int cell(const std::pair<int, int>& pos) const
+    {
+        return pos.first * width + pos.second;
+    }
+
+    bool is_legal(const int from, const int action) const
+    {
+        return (legal_moves[from] >> action) & 1;
+    }
+
+    static uint64_t zobrist_key(const size_t agent, const int c)
+    {
+        return splitmix64((uint64_t(agent) << 32) | uint32_t(c));
+    }
+
+    void rehash()
+    {
+        state_hash = 0;
+        for(size_t i = 0; i < num_agents; i++)
+            state_hash ^= zobrist_key(i, cell(cur_positions[i]));
+    }
+
+    // Coordinates from Python are checked before they index any grid: the
+    // checks throw py::value_error for cells off the map or on obstacles.
+    static std::string describe(const char* what, const long agent, const int i, const int j)
+    {
+        const std::string cell_name = std::string(what) + " (" + std::to_string(i) + ", " + std::to_string(j) + ")";
+        return agent < 0 ? cell_name : cell_name + " of agent " + std::to_string(agent);
+    }
+
+    static void check_on_map(const int i, const int j, const int height_, const int width_, const char* what, const long agent = -1)
+    {
+        if (i < 0 || i >= height_ || j < 0 || j >= width_)
+            throw py::value_error(describe(what, agent, i, j) + " is outside the " + std::to_string(height_) + "x" + std::to_string(width_) + " map");
+    }
+
+    static void check_not_obstacle(const bool obstacle, const int i, const int j, const char* what, const long agent)
+    {
+        if (obstacle)
+            throw py::value_error(describe(what, agent, i, j) + " is an obstacle");
+    }
+
+    void check_free_cell(const int i, const int j, const char* what, const long agent) const
+    {
+        check_on_map(i, j, height, width, what, agent);
+        check_not_obstacle(grid[i][j] == OBSTACLE, i, j, what, agent);
+    }
+
+    void rebuild_occupancy()
+    {
+        std::fill(occupancy.begin(), occupancy.end(), -1);
+        for(size_t i = 0; i < num_agents; i++)
+            if (!reached[i])
+                occupancy[cell(cur_positions[i])] = i;
+    }
 public:
     size_t num_agents;
     std::vector<std::pair<int, int>> moves = {{0,0}, {-1, 0}, {1,0},{0,-1},{0,1}};
     std::vector<std::pair<int, int>> goals;
     std::vector<std::pair<int, int>> cur_positions;
     std::vector<std::vector<int>> grid;
+    int height = 0;
+    int width = 0;
     explicit Environment()
     {
         num_agents = 0;
@@ -39,27 +125,144 @@ public:
         engine.seed(std::chrono::system_clock::now().time_since_epoch().count());
     }
 
+    void set_seed_stream(const uint64_t seed, const int stream)
+    {
+        engine.seed(seed);
+        for(int i = 0; i < stream; i++)
+            engine.jump();
+    }
+
+    // Non-negative seed drawn from this environment's stream, for the random
+    // generators of rollout policies.
+    int draw_seed()
+    {
+        return static_cast<int>(engine() >> 33);
+    }
+
     size_t get_num_agents()
     {
         return num_agents;
     }
 
+    // Agents may be added before create_grid(), which then checks them.
     void add_agent(int si, int sj, int gi, int gj)
     {
+        if (!grid.empty())
+        {
+            check_free_cell(si, sj, "start", num_agents);
+            check_free_cell(gi, gj, "goal", num_agents);
+        }
         cur_positions.push_back({si, sj});
         goals.push_back({gi, gj});
         num_agents++;
         reached.push_back(false);
+        if (!occupancy.empty())
+            occupancy[cell({si, sj})] = num_agents - 1;
+        state_hash ^= zobrist_key(num_agents - 1, cell({si, sj}));
     }
 
-    void create_grid(int height, int width)
+    void create_grid(int height_, int width_)
     {
+        for(size_t i = 0; i < num_agents; i++)
+        {
+            check_on_map(cur_positions[i].first, cur_positions[i].second, height_, width_, "position", i);
+            check_on_map(goals[i].first, goals[i].second, height_, width_, "goal", i);
+        }
+        height = height_;
+        width = width_;
         grid = std::vector<std::vector<int>>(height, std::vector<int>(width,TRAVERSABLE));
+        legal_moves.assign(height * width, 0);
+        for(size_t a = 0; a < moves.size(); a++)
+            cell_offsets[a] = moves[a].first * width + moves[a].second;
+        for(int i = 0; i < height; i++)
+            for(int j = 0; j < width; j++)
+                for(size_t a = 0; a < moves.size(); a++)
+                {
+                    const int ni = i + moves[a].first, nj = j + moves[a].second;
+                    if (ni >= 0 && ni < height && nj >= 0 && nj < width)
+                        legal_moves[cell({i, j})] |= 1 << a;
+                }
+        occupancy.assign(height * width, -1);
+        claims.assign(height * width, 0);
+        rebuild_occupancy();
+        rehash();
     }
 
     void add_obstacle(int i, int j)
     {
+        check_on_map(i, j, height, width, "obstacle");
         grid[i][j] = OBSTACLE;
+        for(size_t a = 1; a < moves.size(); a++)
+        {
+            const int ni = i - moves[a].first, nj = j - moves[a].second;
+            if (ni >= 0 && ni < height && nj >= 0 && nj < width)
+                legal_moves[cell({ni, nj})] &= ~(1 << a);
+        }
+    }
+
+    // Builds the map and the agents in one call from row-major buffers:
+    // obstacles is height_ x width_ (non-zero cells are obstacles), starts and
+    // goals_ are num_agents_ x 2. Every start and goal must be a free cell of the
+    // map, otherwise py::value_error is thrown and the environment is unchanged.
+    void build(const uint8_t* obstacles, const int height_, const int width_,
+               const int32_t* starts, const int32_t* goals_, const size_t num_agents_)
+    {
+        for(size_t i = 0; i < num_agents_; i++)
+        {
+            const int32_t* cells[2] = {starts + 2 * i, goals_ + 2 * i};
+            const char* names[2] = {"start", "goal"};
+            for(int k = 0; k < 2; k++)
+            {
+                check_on_map(cells[k][0], cells[k][1], height_, width_, names[k], i);
+                check_not_obstacle(obstacles[cells[k][0] * width_ + cells[k][1]] != 0, cells[k][0], cells[k][1], names[k], i);
+            }
+        }
+        num_agents = 0;
+        cur_positions.clear();
+        goals.clear();
+        reached.clear();
+        made_actions.clear();
+        create_grid(height_, width_);
+        for(int i = 0; i < height; i++)
+            for(int j = 0; j < width; j++)
+                if (obstacles[i * width + j])
+                    add_obstacle(i, j);
+        for(size_t i = 0; i < num_agents_; i++)
+            add_agent(starts[2 * i], starts[2 * i + 1], goals_[2 * i], goals_[2 * i + 1]);
+    }
+
+    // Moves every agent to positions (num_agents x 2, row-major) and forgets
+    // the undo history, e.g. to follow the real environment between steps.
+    // Positions off the map or on obstacles throw py::value_error first.
+    void sync_positions(const int32_t* positions)
+    {
+        for(size_t i = 0; i < num_agents; i++)
+            check_free_cell(positions[2 * i], positions[2 * i + 1], "position", i);
+        for(size_t i = 0; i < num_agents; i++)
+            if (!reached[i])
+                occupancy[cell(cur_positions[i])] = -1;
+        for(size_t i = 0; i < num_agents; i++)
+        {
+            cur_positions[i] = {positions[2 * i], positions[2 * i + 1]};
+            reached[i] = cur_positions[i] == goals[i];
+        }
+        rebuild_occupancy();
+        rehash();
+        made_actions.clear();
+    }
+
+    bool same_positions(const int32_t* positions) const
+    {
+        for(size_t i = 0; i < num_agents; i++)
+            if (cur_positions[i].first != positions[2 * i] || cur_positions[i].second != positions[2 * i + 1])
+                return false;
+        return true;
+    }
+
+    // Hash of the joint state, kept up to date by step() and step_back().
+    uint64_t get_hash() const
+    {
+        return state_hash;
     }
 
     bool reached_goal(size_t i) const
@@ -75,49 +278,52 @@ public:
         return std::accumulate(reached.begin(), reached.end(), 0);
     }
 
-    double step(std::vector<int> actions)
+    // block_both collisions in O(n): a move fails if it leaves the map, hits an
+    // obstacle, enters a cell currently held by another active agent, or targets
+    // the same cell as any other move. Agents that reached their goal do not block.
+    // record=false skips the undo log: such steps are undone by restore_state(),
+    // not step_back().
+    double step(const std::vector<int>& actions, const bool record = true)
     {
-        std::vector<std::pair<int, int>> executed_pos;
-        for(size_t i = 0; i < num_agents; i++) {
-            if (reached[i])
+        executed_pos = cur_positions;
+        applied = actions;
+        for(size_t i = 0; i < num_agents; i++)
+        {
+            if (reached[i] || applied[i] == 0)
             {
-                executed_pos.push_back(cur_positions[i]);
-                actions[i] = 0;
+                applied[i] = 0;
+                continue;
             }
+            const int from = cell(cur_positions[i]);
+            if (!is_legal(from, applied[i]) || occupancy[from + cell_offsets[applied[i]]] >= 0)
+                applied[i] = 0;
             else
-                executed_pos.emplace_back(cur_positions[i].first + moves[actions[i]].first,
-                                          cur_positions[i].second + moves[actions[i]].second);
+            {
+                executed_pos[i] = {cur_positions[i].first + moves[applied[i]].first,
+                                   cur_positions[i].second + moves[applied[i]].second};
+                claims[from + cell_offsets[applied[i]]]++;
+            }
         }
         for(size_t i = 0; i < num_agents; i++)
-            for(size_t j = i+1; j < num_agents; j++) {
-                if (reached[i] || reached[j])
-                    continue;
-                if (executed_pos[i].first == executed_pos[j].first && executed_pos[i].second == executed_pos[j].second)
-                {
-                    executed_pos[i] = cur_positions[i];
-                    executed_pos[j] = cur_positions[j];
-                    actions[i] = 0;
-                    actions[j] = 0;
-                }
-                if(executed_pos[i].first == cur_positions[j].first && executed_pos[i].second == cur_positions[j].second)
-                {
-                    executed_pos[i] = cur_positions[i];
-                    actions[i] = 0;
-                }
-                if(executed_pos[j].first == cur_positions[i].first && executed_pos[j].second == cur_positions[i].second)
-                {
-                    executed_pos[j] = cur_positions[j];
-                    actions[j] = 0;
-                }
+            if (applied[i] != 0 && claims[cell(executed_pos[i])] > 1)
+                applied[i] = -applied[i];
+        for(size_t i = 0; i < num_agents; i++)
+        {
+            if (applied[i] == 0)
+                continue;
+            claims[cell(executed_pos[i])] = 0;
+            if (applied[i] < 0)
+            {
+                executed_pos[i] = cur_positions[i];
+                applied[i] = 0;
             }
+        }
         double reward(0);
         for(size_t i = 0; i < num_agents; i++)
-            if(executed_pos[i].first < 0 || executed_pos[i].first >= static_cast<int>(grid.size()) ||
-               executed_pos[i].second < 0 || executed_pos[i].second >= static_cast<int>(grid[0].size())
-               || grid[executed_pos[i].first][executed_pos[i].second])
+            if (applied[i] != 0)
             {
-                executed_pos[i] = cur_positions[i];
-                actions[i] = 0;
+                occupancy[cell(cur_positions[i])] = -1;
+                state_hash ^= zobrist_key(i, cell(cur_positions[i])) ^ zobrist_key(i, cell(executed_pos[i]));
             }
         for(size_t i = 0; i < num_agents; i++) {
             if (reached[i])
@@ -126,38 +332,83 @@ public:
             {
                 reward += 1;
                 reached[i] = true;
+                occupancy[cell(executed_pos[i])] = -1;
             }
+            else if (applied[i] != 0)
+                occupancy[cell(executed_pos[i])] = i;
         }
-        made_actions.push_back(actions);
-        cur_positions = executed_pos;
+        if (record)
+            made_actions.insert(made_actions.end(), applied.begin(), applied.end());
+        cur_positions.swap(executed_pos);
         return reward;
     }
 
     void step_back()
     {
+        for(size_t i = 0; i < num_agents; i++)
+            if (!reached[i])
+                occupancy[cell(cur_positions[i])] = -1;
+        const int* last = made_actions.data() + made_actions.size() - num_agents;
         for(size_t i = 0; i < num_agents; i++)
         {
-            cur_positions[i].first = cur_positions[i].first - moves[made_actions.back()[i]].first;
-            cur_positions[i].second = cur_positions[i].second - moves[made_actions.back()[i]].second;
+            if (last[i] != 0)
+                state_hash ^= zobrist_key(i, cell(cur_positions[i])) ^ zobrist_key(i, cell(cur_positions[i]) - cell_offsets[last[i]]);
+            cur_positions[i].first = cur_positions[i].first - moves[last[i]].first;
+            cur_positions[i].second = cur_positions[i].second - moves[last[i]].second;
             if(cur_positions[i].first != goals[i].first || cur_positions[i].second != goals[i].second)
                 reached[i] = false;
         }
-        made_actions.pop_back();
+        for(size_t i = 0; i < num_agents; i++)
+            if (!reached[i])
+                occupancy[cell(cur_positions[i])] = i;
+        made_actions.resize(made_actions.size() - num_agents);
     }
 
-    std::vector<int> sample_actions(int num_actions, const bool use_move_limits=false, const bool agents_as_obstackles=false)
+    void save_state(EnvironmentSnapshot& snapshot) const
     {
-        std::vector<int> actions;
+        snapshot.positions.assign(cur_positions.begin(), cur_positions.end());
+        snapshot.reached = reached;
+        snapshot.hash = state_hash;
+    }
+
+    // Returns to a state saved by save_state() in O(num_agents). The undo log is
+    // left alone, so the snapshot must come from the same step of it.
+    void restore_state(const EnvironmentSnapshot& snapshot)
+    {
+        for(size_t i = 0; i < num_agents; i++)
+            if (!reached[i])
+                occupancy[cell(cur_positions[i])] = -1;
+        cur_positions.assign(snapshot.positions.begin(), snapshot.positions.end());
+        reached = snapshot.reached;
+        state_hash = snapshot.hash;
+        for(size_t i = 0; i < num_agents; i++)
+            if (!reached[i])
+                occupancy[cell(cur_positions[i])] = i;
+    }
+
+    void sample_actions(std::vector<int>& actions, int num_actions, const bool use_move_limits=false, const bool agents_as_obstackles=false)
+    {
+        actions.resize(num_agents);
         for(size_t i = 0; i < num_agents; i++)
         {
-            auto action = engine() % num_actions;
-            if (use_move_limits)
+            if (!use_move_limits)
             {
-                while (!check_action(i, action, agents_as_obstackles))
-                    action = engine() % num_actions;
+                actions[i] = engine.bounded(num_actions);
+                continue;
             }
-            actions.emplace_back(action);
+            int legal[5];
+            int num_legal = 0;
+            for(int action = 0; action < num_actions; action++)
+                if (check_action(i, action, agents_as_obstackles))
+                    legal[num_legal++] = action;
+            actions[i] = num_legal > 0 ? legal[engine.bounded(num_legal)] : 0;
         }
+    }
+
+    std::vector<int> sample_actions(int num_actions, const bool use_move_limits=false, const bool agents_as_obstackles=false)
+    {
+        std::vector<int> actions;
+        sample_actions(actions, num_actions, use_move_limits, agents_as_obstackles);
         return actions;
     }
 
@@ -196,27 +447,35 @@ public:
 
     const bool check_action(const int agent_idx, const int action, const bool agents_as_obstacles) const
     {
-        //std::cout<<"ag_idx "<<agent_idx<<"\n";
-        const std::pair<int, int> future_position = {cur_positions[agent_idx].first + moves[action].first, cur_positions[agent_idx].second + moves[action].second};
-        //std::cout<<"gs "<<grid.size()<<" pos "<<future_position.first<<" "<<future_position.second<<"\n";
-        if (future_position.first < 0 || future_position.second < 0 || future_position.first >= static_cast<int>(grid.size()) || future_position.second >= static_cast<int>(grid.size()))
-            return false;
-        if (grid[future_position.first][future_position.second] == 1)
+        const int from = cell(cur_positions[agent_idx]);
+        if (!is_legal(from, action))
             return false;
         if (agents_as_obstacles)
         {
-            for (size_t i = 0; i < num_agents; i++)
-            {
-                if (static_cast<int>(i) != agent_idx)
-                {
-                    if((cur_positions[i].first == future_position.first) && (cur_positions[i].second == future_position.second))
-                        return false;
-                }
-            }
+            const int occupant = occupancy[from + cell_offsets[action]];
+            return occupant < 0 || occupant == agent_idx;
         }
         return true;
     }
 
+    // Adopts the agent state of an environment built on the same map, keeping
+    // this one's grid and buffers. Costs O(num_agents) and allocates nothing.
+    void copy_state_from(const Environment& orig)
+    {
+        for(size_t i = 0; i < num_agents; i++)
+            if (!reached[i])
+                occupancy[cell(cur_positions[i])] = -1;
+        cur_positions.assign(orig.cur_positions.begin(), orig.cur_positions.end());
+        goals.assign(orig.goals.begin(), orig.goals.end());
+        reached = orig.reached;
+        num_agents = orig.num_agents;
+        made_actions.clear();
+        for(size_t i = 0; i < num_agents; i++)
+            if (!reached[i])
+                occupancy[cell(cur_positions[i])] = i;
+        state_hash = orig.state_hash;
+    }
+
     Environment(const Environment& orig)
     {
         num_agents = orig.num_agents;
@@ -227,25 +486,256 @@ public:
         made_actions = orig.made_actions;
         reached = orig.reached;
         engine = orig.engine;
-        reset_seed();
+        height = orig.height;
+        width = orig.width;
+        legal_moves = orig.legal_moves;
+        std::copy(std::begin(orig.cell_offsets), std::end(orig.cell_offsets), std::begin(cell_offsets));
+        occupancy = orig.occupancy;
+        claims = orig.claims;
+        state_hash = orig.state_hash;
     }
 };
 
+// bit[mask][n] is the index of the n-th set bit of a 5-bit action mask.
+struct NthSetBit
+{
+    uint8_t bit[32][5] = {};
+
+    constexpr NthSetBit()
+    {
+        for(unsigned mask = 0; mask < 32; mask++)
+            for(unsigned a = 0, n = 0; a < 5; a++)
+                if ((mask >> a) & 1)
+                    bit[mask][n++] = a;
+    }
+};
+inline constexpr NthSetBit nth_set_bit{};
+
+// Many random rollouts of one environment state, advanced in lockstep. The
+// state is kept as structure of arrays in agent-major order (entry
+// agent * lanes + lane) with flat cell indices and byte reached flags, and the
+// occupancy and claim grids interleave the lanes per cell. step_random() runs
+// as separate passes over all entries: draw, propose, claim, resolve and
+// commit. The passes select instead of branching and every entry has its own
+// random stream, so only the claim and occupancy scatters are left serial.
+// The collision rules are those of Environment::step().
+class EnvironmentBatch
+{
+    size_t lanes = 0;
+    size_t num_agents = 0;
+    size_t num_cells = 0;
+    const uint8_t* legal_moves = nullptr;
+    int cell_offsets[5] = {0, 0, 0, 0, 0};
+    std::vector<int32_t> goals;
+    std::vector<int32_t> positions;
+    std::vector<int32_t> targets;
+    std::vector<uint8_t> reached;
+    std::vector<uint8_t> moving;
+    std::vector<int32_t> occupancy;
+    std::vector<uint8_t> claims;
+    std::vector<uint32_t> draws;
+    size_t num_done = 0;
+    Xoshiro256 engine;
+    Xoshiro256Streams streams;
+
+    // Returns the occupancy grid to all free, touching only the cells in use.
+    void release_cells()
+    {
+        for(size_t i = 0; i < num_agents; i++)
+            for(size_t l = 0; l < lanes; l++)
+                if (!reached[i * lanes + l])
+                    occupancy[positions[i * lanes + l] * lanes + l] = -1;
+    }
+
+    // Picks the action of every entry from its draw and sets its target: the
+    // next cell if the move is legal and the cell is free, else its position.
+    template<bool use_move_limits, bool agents_as_obstacles>
+    void propose(const unsigned action_mask)
+    {
+        for(size_t i = 0; i < num_agents; i++)
+            for(size_t l = 0; l < lanes; l++)
+            {
+                const size_t k = i * lanes + l;
+                const int32_t from = positions[k];
+                const unsigned legal = legal_moves[from];
+                unsigned mask = use_move_limits ? legal & action_mask : action_mask;
+                if constexpr (agents_as_obstacles)
+                    for(unsigned a = 1; a < 5; a++)
+                    {
+                        const int32_t next = (legal >> a) & 1 ? from + cell_offsets[a] : from;
+                        const int32_t occupant = occupancy[next * lanes + l];
+                        mask &= ~(unsigned((occupant >= 0) & (occupant != static_cast<int32_t>(i))) << a);
+                    }
+                const unsigned action = nth_set_bit.bit[mask][uint64_t(draws[k]) * __builtin_popcount(mask) >> 32];
+                const int32_t to = (legal >> action) & 1 ? from + cell_offsets[action] : from;
+                targets[k] = !reached[k] & (occupancy[to * lanes + l] < 0) ? to : from;
+            }
+    }
+
+public:
+    void seed(const uint64_t seed_)
+    {
+        engine.seed(seed_);
+        streams.seed(engine, positions.size());
+    }
+
+    // Starts lanes_ rollouts from the current state of env.
+    void reset(const Environment& env, const size_t lanes_)
+    {
+        const size_t num_cells_ = env.height * env.width;
+        if (lanes_ != lanes || num_cells_ != num_cells || env.num_agents != num_agents)
+        {
+            lanes = lanes_;
+            num_cells = num_cells_;
+            num_agents = env.num_agents;
+            positions.assign(num_agents * lanes, 0);
+            targets.assign(num_agents * lanes, 0);
+            reached.assign(num_agents * lanes, 1);
+            moving.assign(num_agents * lanes, 0);
+            occupancy.assign(num_cells * lanes, -1);
+            claims.assign(num_cells * lanes, 0);
+            draws.assign(num_agents * lanes, 0);
+            streams.seed(engine, num_agents * lanes);
+        }
+        else
+            release_cells();
+        legal_moves = env.legal_moves.data();
+        std::copy(std::begin(env.cell_offsets), std::end(env.cell_offsets), std::begin(cell_offsets));
+        goals.resize(num_agents);
+        num_done = 0;
+        for(size_t i = 0; i < num_agents; i++)
+        {
+            goals[i] = env.cell(env.goals[i]);
+            const int32_t c = env.cell(env.cur_positions[i]);
+            const uint8_t done = env.reached[i];
+            num_done += done * lanes;
+            for(size_t l = 0; l < lanes; l++)
+            {
+                positions[i * lanes + l] = c;
+                reached[i * lanes + l] = done;
+                if (!done)
+                    occupancy[c * lanes + l] = i;
+            }
+        }
+    }
+
+    bool all_done() const
+    {
+        return num_done == num_agents * lanes;
+    }
+
+    size_t get_lanes() const
+    {
+        return lanes;
+    }
+
+    size_t get_num_agents() const
+    {
+        return num_agents;
+    }
+
+    // Flat cell index (row * width + column) of the agent in lane.
+    int32_t cell(const size_t agent, const size_t lane) const
+    {
+        return positions[agent * lanes + lane];
+    }
+
+    bool reached_goal(const size_t agent, const size_t lane) const
+    {
+        return reached[agent * lanes + lane];
+    }
+
+    // Every active agent of every lane takes a uniformly random action (among
+    // the legal ones with use_move_limits). Returns the number of agents that
+    // reached their goal in this step, summed over the lanes.
+    int step_random(const int num_actions, const bool use_move_limits, const bool agents_as_obstacles)
+    {
+        const unsigned action_mask = (1u << num_actions) - 1;
+        streams.next(draws.data());
+        if (!use_move_limits)
+            propose<false, false>(action_mask);
+        else if (!agents_as_obstacles)
+            propose<true, false>(action_mask);
+        else
+            propose<true, true>(action_mask);
+        for(size_t i = 0; i < num_agents; i++)
+            for(size_t l = 0; l < lanes; l++)
+            {
+                const size_t k = i * lanes + l;
+                claims[targets[k] * lanes + l] += targets[k] != positions[k];
+            }
+        for(size_t i = 0; i < num_agents; i++)
+            for(size_t l = 0; l < lanes; l++)
+            {
+                const size_t k = i * lanes + l;
+                moving[k] = (targets[k] != positions[k]) & (claims[targets[k] * lanes + l] == 1);
+            }
+        // A moving agent enters a cell that was free, so it never meets the
+        // old cell of another mover; agents that reached their goal share
+        // cells with active ones and write back what they read.
+        int reward = 0;
+        for(size_t i = 0; i < num_agents; i++)
+        {
+            const int32_t goal = goals[i];
+            for(size_t l = 0; l < lanes; l++)
+            {
+                const size_t k = i * lanes + l;
+                const int32_t from = positions[k];
+                const int32_t to = moving[k] ? targets[k] : from;
+                const uint8_t arrived = !reached[k] & (to == goal);
+                claims[targets[k] * lanes + l] = 0;
+                int32_t& left = occupancy[from * lanes + l];
+                left = moving[k] ? -1 : left;
+                int32_t& entered = occupancy[to * lanes + l];
+                entered = arrived ? -1 : moving[k] ? static_cast<int32_t>(i) : entered;
+                positions[k] = to;
+                reached[k] |= arrived;
+                reward += arrived;
+            }
+        }
+        num_done += reward;
+        return reward;
+    }
+};
+
+using grid_array = py::array_t<uint8_t, py::array::c_style | py::array::forcecast>;
+using positions_array = py::array_t<int32_t, py::array::c_style | py::array::forcecast>;
+
+inline void check_positions(const positions_array& positions, const ssize_t num_agents, const char* name)
+{
+    if (positions.ndim() != 2 || positions.shape(1) != 2 || (num_agents >= 0 && positions.shape(0) != num_agents))
+        throw std::invalid_argument(std::string(name) + " must have shape (num_agents, 2)");
+}
+
 PYBIND11_MODULE(environment, m) {
     py::class_<Environment>(m, "Environment")
             .def(py::init<>())
             .def("all_done", &Environment::all_done)
-            .def("sample_actions", &Environment::sample_actions)
-            .def("step", &Environment::step)
+            .def("sample_actions", py::overload_cast<int, const bool, const bool>(&Environment::sample_actions))
+            .def("step", &Environment::step, py::arg("actions"), py::arg("record") = true)
             .def("step_back", &Environment::step_back)
             .def("set_seed", &Environment::set_seed)
             .def("reset_seed", &Environment::reset_seed)
+            .def("set_seed_stream", &Environment::set_seed_stream)
             .def("create_grid", &Environment::create_grid)
             .def("add_obstacle", &Environment::add_obstacle)
             .def("add_agent", &Environment::add_agent)
             .def("render", &Environment::render)
             .def("get_num_agents", &Environment::get_num_agents)
             .def("reached_goal", &Environment::reached_goal)
+            .def("build", [](Environment& env, const grid_array& obstacles, const positions_array& starts, const positions_array& goals)
+            {
+                if (obstacles.ndim() != 2)
+                    throw std::invalid_argument("obstacles must be a 2D array");
+                check_positions(starts, -1, "starts");
+                check_positions(goals, starts.shape(0), "goals");
+                env.build(obstacles.data(), obstacles.shape(0), obstacles.shape(1), starts.data(), goals.data(), starts.shape(0));
+            })
+            .def("sync_positions", [](Environment& env, const positions_array& positions)
+            {
+                check_positions(positions, env.get_num_agents(), "positions");
+                env.sync_positions(positions.data());
+            })
             ;
 }
 
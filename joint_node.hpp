@@ -0,0 +1,66 @@
+#pragma once
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+#include "node.hpp"
+#include "xoshiro.hpp"
+
+struct ActionStats
+{
+    double w = 0;
+    uint32_t cnt = 0;
+};
+
+// Node of the decoupled search: one per joint step instead of one per agent.
+// Every agent keeps its own statistics for each of its actions and picks its
+// action independently (decoupled UCT); the joint action then selects the
+// child. Only the single-threaded search loop touches these nodes.
+class JointNode
+{
+public:
+    JointNode* parent;
+    uint32_t cnt;
+    std::vector<ActionStats> action_stats;
+    std::unordered_map<uint64_t, JointNode*> children;
+
+    JointNode(JointNode* _parent, const size_t num_agents)
+            : parent(_parent), cnt(0), action_stats(num_agents * max_actions)
+    {
+    }
+
+    ActionStats& stats(const int agent_idx, const int action)
+    {
+        return action_stats[agent_idx * max_actions + action];
+    }
+
+    const ActionStats& stats(const int agent_idx, const int action) const
+    {
+        return action_stats[agent_idx * max_actions + action];
+    }
+
+    int most_visited(const int agent_idx, const int num_actions) const
+    {
+        int best_action(0);
+        uint32_t best_cnt = 0;
+        for (int k = 0; k < num_actions; k++)
+        {
+            if (stats(agent_idx, k).cnt > best_cnt)
+            {
+                best_action = k;
+                best_cnt = stats(agent_idx, k).cnt;
+            }
+        }
+        return best_action;
+    }
+};
+
+// Key of a joint action in JointNode::children.
+inline uint64_t joint_action_key(const std::vector<int>& actions)
+{
+    uint64_t key = 0;
+    for (size_t i = 0; i < actions.size(); i++)
+    {
+        key ^= splitmix64((uint64_t(i) << 3) | uint64_t(actions[i]));
+    }
+    return key;
+}
@@ -48,14 +48,9 @@ def main():
     replan = RePlan()
     replan.init(env.get_num_agents(),gc.obs_radius,True,0.2,True, 10000000, -1, False)
     cpp_env = Environment()
-    for i in range(env.get_num_agents()):
-        cpp_env.add_agent(env.grid.positions_xy[i][0], env.grid.positions_xy[i][1],
-                env.grid.finishes_xy[i][0], env.grid.finishes_xy[i][1])
-        cpp_env.create_grid(len(env.grid.obstacles),len(env.grid.obstacles[0]))
-    for i in range(len(env.grid.obstacles)):
-        for j in range(len(env.grid.obstacles[0])):
-            if env.grid.obstacles[i][j]:
-                cpp_env.add_obstacle(i, j)
+    cpp_env.build(np.asarray(env.grid.obstacles, dtype=np.uint8),
+                  np.asarray(env.grid.positions_xy, dtype=np.int32),
+                  np.asarray(env.grid.finishes_xy, dtype=np.int32))
     mcts.set_env(cpp_env, gc.obs_radius)
     replan.set_env(cpp_env)
     done = [False]
@@ -63,6 +58,7 @@ def main():
     while not all(done):
         actions = mcts.act()
         obs, rew, done, info = env.step(actions)
+        mcts.sync_positions(np.asarray(env.grid.positions_xy, dtype=np.int32))
         env.render()
     end = time() - start
     results.append(info[0]['metrics'])
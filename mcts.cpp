@@ -2,15 +2,12 @@
 #include <pybind11/pybind11.h>
 #include <pybind11/stl.h>
 #include <pybind11/stl_bind.h>
-#include "BS_thread_pool.hpp"
 #include "mcts.hpp"
 #include <mutex>
-#include <deque>
 #include <utility>
 #include <functional>
 #include <chrono>
 
-std::mutex insert_mutex;
 namespace py = pybind11;
 
 template<typename T>
@@ -24,103 +21,486 @@ void pop_front(std::vector<T>& vec)
 MonteCarloTreeSearch::MonteCarloTreeSearch()
 {depth=0;}
 
-Node* MonteCarloTreeSearch::safe_insert_node(Node* n, const int action, const double score, const int num_actions, const int next_agent_idx)
+MonteCarloTreeSearch::MonteCarloTreeSearch(const unsigned num_threads) : pool(num_threads)
+{depth=0;}
+
+MonteCarloTreeSearch::~MonteCarloTreeSearch()
+{
+    wait_pending_search();
+}
+
+void MonteCarloTreeSearch::wait_pending_search() const
+{
+    std::shared_future<std::vector<int>> pending;
+    {
+        std::lock_guard<std::mutex> lock(pending_mutex);
+        pending = pending_search;
+    }
+    if (pending.valid())
+    {
+        pending.wait();
+    }
+}
+
+std::unique_lock<std::mutex> MonteCarloTreeSearch::lock_idle() const
+{
+    wait_pending_search();
+    return std::unique_lock<std::mutex>(search_mutex);
+}
+
+std::vector<int> MonteCarloTreeSearch::act()
+{
+    const auto lock = lock_idle();
+    return run_act();
+}
+
+SearchFuture MonteCarloTreeSearch::act_async()
+{
+    std::lock_guard<std::mutex> lock(pending_mutex);
+    const auto previous = pending_search;
+    pending_search = std::async(std::launch::async, [this, previous]
+    {
+        if (previous.valid())
+        {
+            previous.wait();
+        }
+        std::lock_guard<std::mutex> lock(search_mutex);
+        return run_act();
+    }).share();
+    return SearchFuture(pending_search);
+}
+
+Node* MonteCarloTreeSearch::safe_insert_node(Node* n, const int action, const double score, const int num_actions, const int next_agent_idx, const int process_num)
+{
+    if (cfg.collect_stats && process_num < static_cast<int>(thread_stats.size()))
+    {
+        thread_stats[process_num].nodes_allocated++;
+    }
+    return nodes.create(process_num, nodes.handle(n), action, score, num_actions, next_agent_idx);
+}
+
+bool MonteCarloTreeSearch::insert_child(Node* n, const int action, const double score, const int next_agent_idx, const int process_num)
+{
+    Node* child = safe_insert_node(n, action, score, cfg.num_actions, next_agent_idx, process_num);
+    NodeHandle expected = 0;
+    if (n->child_nodes[action].compare_exchange_strong(expected, nodes.handle(child)))
+    {
+        return true;
+    }
+    if (cfg.collect_stats)
+    {
+        thread_stats[process_num].insert_races++;
+    }
+    nodes.destroy(child);
+    return false;
+}
+
+void MonteCarloTreeSearch::release_subtree(Node* n)
+{
+    gc_stack.push_back(n);
+    while (!gc_stack.empty())
+    {
+        Node* cur = gc_stack.back();
+        gc_stack.pop_back();
+        for (const auto& child : cur->child_nodes)
+        {
+            if (child != 0)
+            {
+                gc_stack.push_back(nodes.get(child));
+            }
+        }
+        nodes.destroy(cur);
+    }
+}
+
+Node* MonteCarloTreeSearch::advance_root(Node* n, const int action, const int next_agent_idx)
+{
+    Node* next = nodes.get(n->child_nodes[action]);
+    if (next == nullptr)
+    {
+        next = safe_insert_node(n, action, 0, cfg.num_actions, next_agent_idx);
+    }
+    n->child_nodes[action] = 0;
+    release_subtree(n);
+    next->parent = 0;
+    return next;
+}
+
+Environment& MonteCarloTreeSearch::search_env(const int process_num)
+{
+    return penvs[process_num];
+}
+
+size_t MonteCarloTreeSearch::get_num_agents() const
 {
-    const std::lock_guard<std::mutex> lock(insert_mutex);
-    all_nodes.emplace_back(n, action, score, num_actions, next_agent_idx);
-    return &all_nodes.back();
+    const auto lock = lock_idle();
+    return penvs.empty() ? 0 : penvs[0].num_agents;
+}
+
+size_t MonteCarloTreeSearch::get_num_nodes() const
+{
+    const auto lock = lock_idle();
+    return nodes.num_live() + joint_nodes.num_live();
+}
+
+size_t MonteCarloTreeSearch::get_nodes_bytes() const
+{
+    const auto lock = lock_idle();
+    return nodes.bytes_live() + joint_nodes.bytes_live();
+}
+
+size_t MonteCarloTreeSearch::get_reserved_bytes() const
+{
+    const auto lock = lock_idle();
+    return nodes.bytes_reserved() + joint_nodes.bytes_reserved();
+}
+
+SearchStats MonteCarloTreeSearch::get_search_stats() const
+{
+    const auto lock = lock_idle();
+    return search_stats;
+}
+
+void MonteCarloTreeSearch::begin_iteration(const int process_num)
+{
+    if (cfg.collect_stats)
+    {
+        thread_stats[process_num].iterations++;
+        thread_stats[process_num].start();
+    }
+}
+
+void MonteCarloTreeSearch::mark_phase(const int process_num, const SearchPhase phase)
+{
+    if (cfg.collect_stats)
+    {
+        thread_stats[process_num].mark(phase);
+    }
+}
+
+void MonteCarloTreeSearch::record_leaf_depth(const Node* n, const int process_num)
+{
+    if (cfg.collect_stats)
+    {
+        int leaf_depth = 1;
+        for (const Node* p = n; p->parent != 0; p = nodes.get(p->parent))
+        {
+            leaf_depth++;
+        }
+        thread_stats[process_num].record_depth(leaf_depth);
+    }
+}
+
+void MonteCarloTreeSearch::reset_search_stats()
+{
+    search_stats = SearchStats();
+    if (cfg.collect_stats)
+    {
+        std::fill(thread_stats.begin(), thread_stats.end(), ThreadStats());
+        pool.take_wait_ns();
+        pool.take_waited_tasks();
+    }
+    pool.set_timing(cfg.collect_stats);
+}
+
+void MonteCarloTreeSearch::collect_search_stats(const std::chrono::steady_clock::time_point act_start)
+{
+    if (!cfg.collect_stats)
+    {
+        return;
+    }
+    search_stats.act_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - act_start).count();
+    for (const auto& thread : thread_stats)
+    {
+        search_stats.add(thread);
+    }
+    search_stats.pool_wait_ms = pool.take_wait_ns() * 1e-6;
+    search_stats.pool_tasks = pool.take_waited_tasks();
+    search_stats.nodes_live = nodes.num_live() + joint_nodes.num_live();
+}
+
+// Sum of the goal distances of the agents still on their way, the progress
+// measure of the rollout stagnation check.
+int64_t MonteCarloTreeSearch::remaining_distance(const Environment& penv) const
+{
+    int64_t total = 0;
+    for (size_t i = 0; i < penv.num_agents; i++)
+    {
+        if (!penv.reached_goal(i))
+        {
+            total += distance_fields.distance(goal_distances[i], penv.cur_positions[i].first, penv.cur_positions[i].second);
+        }
+    }
+    return total;
+}
+
+int64_t MonteCarloTreeSearch::remaining_distance(const EnvironmentBatch& batch) const
+{
+    int64_t total = 0;
+    for (size_t i = 0; i < batch.get_num_agents(); i++)
+    {
+        const uint16_t* field = goal_distances[i];
+        for (size_t l = 0; l < batch.get_lanes(); l++)
+        {
+            if (!batch.reached_goal(i, l))
+            {
+                total += field != nullptr ? field[batch.cell(i, l)] : DistanceFieldCache::unreachable;
+            }
+        }
+    }
+    return total;
+}
+
+// Value of a truncated rollout's last state: every agent still on its way
+// counts as reaching its goal after its shortest-path distance, gamma^distance.
+double MonteCarloTreeSearch::truncated_value(const Environment& penv) const
+{
+    double value = 0;
+    for (size_t i = 0; i < penv.num_agents; i++)
+    {
+        const uint16_t distance = penv.reached_goal(i) ? DistanceFieldCache::unreachable
+                : distance_fields.distance(goal_distances[i], penv.cur_positions[i].first, penv.cur_positions[i].second);
+        if (distance != DistanceFieldCache::unreachable)
+        {
+            value += std::pow(cfg.gamma, distance);
+        }
+    }
+    return cfg.rollout_value_coef * value;
+}
+
+double MonteCarloTreeSearch::truncated_value(const EnvironmentBatch& batch) const
+{
+    double value = 0;
+    for (size_t i = 0; i < batch.get_num_agents(); i++)
+    {
+        const uint16_t* field = goal_distances[i];
+        for (size_t l = 0; l < batch.get_lanes(); l++)
+        {
+            if (field != nullptr && !batch.reached_goal(i, l) && field[batch.cell(i, l)] != DistanceFieldCache::unreachable)
+            {
+                value += std::pow(cfg.gamma, field[batch.cell(i, l)]);
+            }
+        }
+    }
+    return cfg.rollout_value_coef * value;
 }
 
 double MonteCarloTreeSearch::single_simulation(const int process_num)
 {
     // std::chrono::steady_clock::time_point begin = // std::chrono::steady_clock::now();
-    penvs[process_num].reset_seed();
     double score(0);
     double g(1), reward(0);
     int num_steps(0);
-    RePlan replan;
+    RolloutWorkspace& workspace = workspaces[process_num];
+    std::optional<RePlan>& replan = workspace.replan;
     if (cfg.use_replansim)
     {
-        replan = RePlan();
-        replan.init(penvs[process_num].get_num_agents(), obs_radius, true, 0.2, true, 10000000, -1, false);
-        replan.set_env(penvs[process_num]);
+        if (!replan)
+        {
+            replan.emplace();
+            replan->init(penvs[process_num].get_num_agents(), obs_radius, true, 0.2, true, 10000000, penvs[process_num].draw_seed(), false);
+            replan->set_env(penvs[process_num]);
+            replan->set_distance_fields(&distance_fields);
+        }
+        else
+        {
+            replan->reset(penvs[process_num]);
+        }
     }
-    while(!penvs[process_num].all_done() && num_steps < cfg.steps_limit)
+    std::vector<int>& actions_tbd = workspace.actions;
+    penvs[process_num].save_state(workspace.rollout_start);
+    const int max_steps = cfg.rollout_depth > 0 ? std::min(cfg.rollout_depth, cfg.steps_limit) : cfg.steps_limit;
+    int64_t best_distance = cfg.rollout_stagnation_steps > 0 ? remaining_distance(penvs[process_num]) : 0;
+    int stagnant_steps = 0;
+    // only rollouts cut short by rollout_depth or stagnation get the distance estimate
+    bool truncated = false;
+    while(!penvs[process_num].all_done() && num_steps < max_steps)
     {
-        std::vector<int> actions_tbd;
-        actions_tbd.reserve(penvs[process_num].get_num_agents());
         if (cfg.use_replansim)
         {
-            actions_tbd = replan.act();
+            actions_tbd = replan->act();
         }
         else
         {
-            actions_tbd = penvs[process_num].sample_actions(cfg.num_actions, cfg.use_move_limits, cfg.agents_as_obstacles);
+            penvs[process_num].sample_actions(actions_tbd, cfg.num_actions, cfg.use_move_limits, cfg.agents_as_obstacles);
         }
-        reward = penvs[process_num].step(actions_tbd);
+        reward = penvs[process_num].step(actions_tbd, false);
         num_steps++;
         score += reward*g;
         g *= cfg.gamma;
+        if (cfg.rollout_stagnation_steps > 0)
+        {
+            const int64_t distance = remaining_distance(penvs[process_num]);
+            if (distance < best_distance)
+            {
+                best_distance = distance;
+                stagnant_steps = 0;
+            }
+            else if (++stagnant_steps >= cfg.rollout_stagnation_steps)
+            {
+                truncated = true;
+                break;
+            }
+        }
     }
-    for (int i = 0; i < num_steps; i++)
+    truncated = truncated || (num_steps == max_steps && max_steps < cfg.steps_limit);
+    if (truncated && cfg.rollout_value_coef > 0 && !penvs[process_num].all_done())
     {
-        penvs[process_num].step_back();
+        score += g*truncated_value(penvs[process_num]);
     }
+    penvs[process_num].restore_state(workspace.rollout_start);
     // std::chrono::steady_clock::time_point end = // std::chrono::steady_clock::now();
     // std::cout << "simulation = " << // std::chrono::duration_cast<// std::chrono::microseconds>(end - begin).count() << "[µs]" << std::endl;
     return score;
 }
 
+// Runs all multi_simulations random rollouts of process_num at once on its
+// environment batch and returns the sum of their scores.
+double MonteCarloTreeSearch::lockstep_simulation(const int process_num)
+{
+    EnvironmentBatch& batch = workspaces[process_num].batch;
+    batch.reset(penvs[process_num], cfg.multi_simulations);
+    double score(0), g(1);
+    const int max_steps = cfg.rollout_depth > 0 ? std::min(cfg.rollout_depth, cfg.steps_limit) : cfg.steps_limit;
+    int64_t best_distance = cfg.rollout_stagnation_steps > 0 ? remaining_distance(batch) : 0;
+    int stagnant_steps = 0;
+    bool truncated = false;
+    int num_steps = 0;
+    for (; num_steps < max_steps && !batch.all_done(); num_steps++)
+    {
+        score += g*batch.step_random(cfg.num_actions, cfg.use_move_limits, cfg.agents_as_obstacles);
+        g *= cfg.gamma;
+        if (cfg.rollout_stagnation_steps > 0)
+        {
+            const int64_t distance = remaining_distance(batch);
+            if (distance < best_distance)
+            {
+                best_distance = distance;
+                stagnant_steps = 0;
+            }
+            else if (++stagnant_steps >= cfg.rollout_stagnation_steps)
+            {
+                truncated = true;
+                break;
+            }
+        }
+    }
+    truncated = truncated || (num_steps == max_steps && max_steps < cfg.steps_limit);
+    if (truncated && cfg.rollout_value_coef > 0 && !batch.all_done())
+    {
+        score += g*truncated_value(batch);
+    }
+    return score;
+}
+
+// Index in penvs and workspaces of a rollout lane of process_num. Lane 0 is
+// process_num's own environment.
+int MonteCarloTreeSearch::rollout_lane(const int process_num, const int lane) const
+{
+    return lane == 0 ? process_num : num_envs + process_num * (cfg.multi_simulations - 1) + lane - 1;
+}
+
 double MonteCarloTreeSearch::simulation(const int process_num = 0)
 {
     double score(0);
-    if (cfg.multi_simulations > 1)
+    int num_rollouts(1);
+    if (cfg.multi_simulations > 1 && cfg.lockstep_rollouts && !cfg.use_replansim)
+    {
+        score = lockstep_simulation(process_num);
+        num_rollouts = cfg.multi_simulations;
+    }
+    else if (cfg.multi_simulations > 1 && cfg.num_shared_workers <= 1)
     {
-        std::vector<std::future<double>> futures;
-        for(int thread = 0; thread < cfg.multi_simulations; thread++)
+        // the other lanes start from this thread's leaf, then all run concurrently
+        for (int lane = 1; lane < cfg.multi_simulations; lane++)
         {
-            futures.push_back(pool.submit(&MonteCarloTreeSearch::single_simulation, this, thread));
+            penvs[rollout_lane(process_num, lane)].copy_state_from(penvs[process_num]);
         }
-        for(int thread = 0; thread < cfg.multi_simulations; thread++)
+        std::atomic<double> total(0);
+        pool.parallel_for(cfg.multi_simulations, [&](const int lane)
         {
-            score += futures[thread].get();
-        }
+            atomic_add(total, single_simulation(rollout_lane(process_num, lane)));
+        });
+        score = total;
+        num_rollouts = cfg.multi_simulations;
     }
     else
     {
+        // shared-tree workers run one rollout each, their parallelism is the workers
         score = single_simulation(process_num);
     }
-    const auto result = score/cfg.multi_simulations;
-    return result;
+    // counted here, rollout lanes have no stats slots of their own
+    if (cfg.collect_stats)
+    {
+        thread_stats[process_num].rollouts += num_rollouts;
+    }
+    return score/num_rollouts;
+}
+
+// The value of a node that steps the environment is the reward of its joint
+// transition plus what follows, so nodes are merged per (state before, state
+// after) pair rather than per resulting state. Every node probes the table
+// once; when it is full the node keeps tt_full and its own statistics.
+void MonteCarloTreeSearch::link_transposition(Node* n, const uint64_t hash_before, const uint64_t hash_after, const int process_num)
+{
+    if (n->tt.load(std::memory_order_relaxed) == 0)
+    {
+        const TTLink link = transpositions.find_or_insert(splitmix64(hash_before) ^ hash_after);
+        n->tt.store(link, std::memory_order_relaxed);
+        if (link == tt_full && cfg.collect_stats)
+        {
+            thread_stats[process_num].tt_misses++;
+        }
+    }
+}
+
+double MonteCarloTreeSearch::heuristic_bonus(const int agent_idx, const int action, const int process_num) const
+{
+    const auto position = penvs[process_num].cur_positions[agent_idx];
+    const auto move = penvs[process_num].moves[action];
+    const uint16_t* field = goal_distances[agent_idx];
+    const int lenpath = distance_fields.distance(field, position.first, position.second)
+            - distance_fields.distance(field, position.first + move.first, position.second + move.second);
+    return cfg.heuristic_coef * lenpath;
 }
 
-double MonteCarloTreeSearch::uct(Node* n, const int agent_idx, const int process_num) const
+double MonteCarloTreeSearch::uct(const Node* n, const int agent_idx, const int process_num) const
 {
-    auto uct_val = n->q + cfg.uct_c*std::sqrt(2.0*std::log(n->parent->cnt)/n->cnt);
+    const double cnt = n->cnt + n->cnt_sne;
+    double value = n->w/cnt;
+    if (const TTEntry* entry = transpositions.get(n->tt.load(std::memory_order_relaxed)))
+    {
+        const uint32_t tt_cnt = entry->cnt.load(std::memory_order_relaxed);
+        if (tt_cnt > 0)
+        {
+            value = entry->w.load(std::memory_order_relaxed)/(tt_cnt + n->cnt_sne);
+        }
+    }
+    const Node* parent = nodes.get(n->parent);
+    auto uct_val = value + cfg.uct_c*std::sqrt(2.0*std::log(parent->cnt + parent->cnt_sne)/cnt);
     if (cfg.heuristic_coef > 0)
     {
-        const auto position = penvs[process_num].cur_positions[agent_idx];
-        const auto move = penvs[process_num].moves[n->action_id];
-        const int lenpath = shortest_paths[agent_idx][position.first][position.second] - shortest_paths[agent_idx][position.first + move.first][position.second + move.second];
-        uct_val += cfg.heuristic_coef * lenpath / n->cnt;
+        uct_val += heuristic_bonus(agent_idx, n->action_id, process_num) / cnt;
     }
     return uct_val;
 }
 
-double MonteCarloTreeSearch::batch_uct(Node* n) const
+double MonteCarloTreeSearch::batch_uct(const Node* n) const
 {
     const int adjusted_count = n->cnt + n->cnt_sne;
-    return n->w/adjusted_count + cfg.uct_c * std::sqrt(2.0 * std::log(n->parent->cnt + n->parent->cnt_sne)/adjusted_count);
+    const Node* parent = nodes.get(n->parent);
+    return n->w/adjusted_count + cfg.uct_c * std::sqrt(2.0 * std::log(parent->cnt + parent->cnt_sne)/adjusted_count);
 }
 
 int MonteCarloTreeSearch::expansion(Node* n, const int agent_idx, const int process_num = 0) const
 {
-    int best_action(0), k(0);
+    int best_action(0);
     double best_score(-1000000);
-    for(auto c: n->child_nodes)
+    for(int k = 0; k < n->num_actions_; k++)
     {
         if ((cfg.use_move_limits && penvs[process_num].check_action(agent_idx, k, cfg.agents_as_obstacles)) || !cfg.use_move_limits)
         {
+            const Node* c = nodes.get(n->child_nodes[k]);
             if(c == nullptr)
             {
                 return k;
@@ -132,13 +512,17 @@ int MonteCarloTreeSearch::expansion(Node* n, const int agent_idx, const int proc
                 best_score = uct_val;
             }
         }
-        k++;
     }
     return best_action;
 }
 
 double MonteCarloTreeSearch::selection(Node* n, std::vector<int> actions, const int process_num = 0)
 {
+    const bool shared_tree = cfg.num_shared_workers > 1;
+    if (shared_tree)
+    {
+        n->cnt_sne.fetch_add(1, std::memory_order_relaxed);
+    }
     int agent_idx = int(actions.size())%penvs[process_num].get_num_agents();
     int next_agent_idx = (agent_idx + 1)%penvs[process_num].get_num_agents();
     int action(0);
@@ -149,52 +533,72 @@ double MonteCarloTreeSearch::selection(Node* n, std::vector<int> actions, const
     }
     if(actions.size() == penvs[process_num].get_num_agents())
     {
+        const uint64_t hash_before = penvs[process_num].get_hash();
         double reward = penvs[process_num].step(actions);
-        n->num_succeeded = penvs[process_num].get_num_done();
+        if (cfg.use_transpositions)
+        {
+            link_transposition(n, hash_before, penvs[process_num].get_hash(), process_num);
+        }
+        n->num_succeeded.store(static_cast<uint16_t>(penvs[process_num].get_num_done()), std::memory_order_relaxed);
         actions.clear();
         if(penvs[process_num].all_done())
+        {
             score = reward;
+            record_leaf_depth(n, process_num);
+            mark_phase(process_num, phase_selection);
+        }
         else
         {
-            if(n->child_nodes[action] == nullptr)
+            if(n->child_nodes[action] == 0)
             {
+                record_leaf_depth(n, process_num);
+                mark_phase(process_num, phase_selection);
                 score = reward + cfg.gamma*simulation(process_num);
-                n->child_nodes[action] = safe_insert_node(n, action, score, cfg.num_actions, next_agent_idx);
+                mark_phase(process_num, phase_rollout);
+                if (!insert_child(n, action, score, next_agent_idx, process_num))
+                    nodes.get(n->child_nodes[action])->update_value(score);
+                mark_phase(process_num, phase_expansion);
             }
             else
-                score = reward +cfg.gamma*selection(n->child_nodes[action], {action}, process_num);
+                score = reward +cfg.gamma*selection(nodes.get(n->child_nodes[action]), {action}, process_num);
         }
         n->update_value(score);
+        if (TTEntry* entry = transpositions.get(n->tt.load(std::memory_order_relaxed)))
+        {
+            entry->update(score);
+        }
         penvs[process_num].step_back();
     }
     else
     {
-        if(n->child_nodes[action] == nullptr)
+        if(n->child_nodes[action] == 0)
         {
-            n->child_nodes[action] = safe_insert_node(n, action, 0, cfg.num_actions, next_agent_idx);
+            insert_child(n, action, 0, next_agent_idx, process_num);
         }
         actions.push_back(action);
-        score = selection(n->child_nodes[action], actions, process_num);
+        score = selection(nodes.get(n->child_nodes[action]), actions, process_num);
         n->update_value(score);
     }
+    if (shared_tree)
+    {
+        n->cnt_sne.fetch_sub(1, std::memory_order_relaxed);
+    }
     return score*cfg.gamma;
 }
 
 int MonteCarloTreeSearch::select_action_for_batch_path(Node* n, const int agent_idx, const int process_num = 0)
 {
-    int best_action(0), k(0);
+    int best_action(0);
     double best_score(-1);
-    for(auto c: n->child_nodes)
+    for(int k = 0; k < n->num_actions_; k++)
     {
         if ((cfg.use_move_limits && penvs[process_num].check_action(agent_idx, k, cfg.agents_as_obstacles)) || !cfg.use_move_limits)
         {
-            if(c == nullptr && !n->mask_picked[k])
+            const Node* c = nodes.get(n->child_nodes[k]);
+            if(c == nullptr && !n->is_picked(k))
                 return k;
             else if (c == nullptr)
-            {
-                k++;
                 continue;
-            }
             const auto uct_val = batch_uct(c);
             if (uct_val > best_score)
             {
@@ -202,7 +606,6 @@ int MonteCarloTreeSearch::select_action_for_batch_path(Node* n, const int agent_
                 best_score = uct_val;
             }
         }
-        k++;
     }
     if (best_score < 0)
     {
@@ -222,15 +625,15 @@ std::vector<int> MonteCarloTreeSearch::batch_selection(Node* n, std::vector<int>
     {
         return actions;
     }
-    if (n->child_nodes[action] == nullptr)
+    if (n->child_nodes[action] == 0)
     {
-        n->mask_picked[action] = true;
+        n->set_picked(action);
         n->cnt_sne += 1;
         return actions;
     }
     else
     {
-        auto new_actions = batch_selection(n->child_nodes[action], actions, process_num);
+        auto new_actions = batch_selection(nodes.get(n->child_nodes[action]), actions, process_num);
         n->cnt_sne += 1;
         return new_actions;
     }
@@ -240,9 +643,11 @@ double MonteCarloTreeSearch::batch_expansion(std::vector<int> path_actions, std:
 {
     double score = 0.0;
     double g = 1.0;
+    EnvironmentSnapshot& path_start = workspaces[process_num].path_start;
+    penvs[process_num].save_state(path_start);
     if(prev_actions.size() == penvs[process_num].get_num_agents())
     {
-        double reward = penvs[process_num].step(prev_actions);
+        double reward = penvs[process_num].step(prev_actions, false);
         score += g * reward;
         g *= cfg.gamma;
         prev_actions.clear();
@@ -252,7 +657,7 @@ double MonteCarloTreeSearch::batch_expansion(std::vector<int> path_actions, std:
         prev_actions.push_back(action);
         if(prev_actions.size() == penvs[process_num].get_num_agents())
         {
-            double reward = penvs[process_num].step(prev_actions);
+            double reward = penvs[process_num].step(prev_actions, false);
             score += g * reward;
             g *= cfg.gamma;
             prev_actions.clear();
@@ -262,6 +667,7 @@ double MonteCarloTreeSearch::batch_expansion(std::vector<int> path_actions, std:
     {
         score += cfg.gamma * simulation(process_num);
     }
+    penvs[process_num].restore_state(path_start);
     return score;
 }
 
@@ -269,8 +675,12 @@ void MonteCarloTreeSearch::loop(std::vector<int>& prev_actions)
 {
     for (int i = 0; i < cfg.num_expansions; i++)
     {
+        if (i > 0 && deadline.expired())
+            break;
+        begin_iteration(0);
         double score = selection(root, prev_actions, 0);
         root->update_value(score);
+        mark_phase(0, phase_backup);
     }
 }
 
@@ -278,9 +688,12 @@ void MonteCarloTreeSearch::batch_loop(std::vector<int>& prev_actions)
 {
     for (int i = 0; i < cfg.num_expansions; i++)
     {
-        root->zero_snes();
-        std::vector<std::future<double>> pool_futures;
+        if (i > 0 && deadline.expired())
+            break;
+        begin_iteration(0);
+        root->zero_snes(nodes);
         std::vector<std::vector<int>> batch_paths;
+        std::vector<int> batch_envs;
         for(int batch = 0; batch < cfg.batch_size; batch++)
         {
             auto batch_actions = batch_selection(root, prev_actions, batch);
@@ -288,46 +701,59 @@ void MonteCarloTreeSearch::batch_loop(std::vector<int>& prev_actions)
             {
                 for([[maybe_unused]] auto& _ : prev_actions)
                     pop_front(batch_actions);
+                if (cfg.collect_stats)
+                {
+                    thread_stats[0].record_depth(batch_actions.size());
+                }
                 batch_paths.push_back(batch_actions);
-                pool_futures.push_back(pool.submit(&MonteCarloTreeSearch::batch_expansion, this, batch_actions, prev_actions, batch));
+                batch_envs.push_back(batch);
             }
         }
+        mark_phase(0, phase_selection);
+        std::vector<double> batch_scores(batch_paths.size());
+        pool.parallel_for(static_cast<int>(batch_paths.size()), [&](const int path)
+        {
+            batch_scores[path] = batch_expansion(batch_paths[path], prev_actions, batch_envs[path]);
+        });
+        mark_phase(0, phase_rollout);
         for (size_t enum_paths = 0; enum_paths < batch_paths.size(); enum_paths++)
         {
             Node* local_root = root;
             for (size_t enum_actions = 0; enum_actions < batch_paths[enum_paths].size() - 1; enum_actions++)
             {
-                local_root = local_root->child_nodes[batch_paths[enum_paths][enum_actions]];
+                local_root = nodes.get(local_root->child_nodes[batch_paths[enum_paths][enum_actions]]);
             }
-            const auto score = pool_futures[enum_paths].get();
+            const auto score = batch_scores[enum_paths];
             const auto action = batch_paths[enum_paths][batch_paths[enum_paths].size() - 1];
-            if(local_root->child_nodes[action] == nullptr)
+            if(local_root->child_nodes[action] == 0)
             {
-                local_root->child_nodes[action] = safe_insert_node(local_root, action, score, cfg.num_actions, (local_root->agent_id + 1) % penvs[0].get_num_agents());
-                local_root->update_value_batch(score);
+                local_root->child_nodes[action] = nodes.handle(safe_insert_node(local_root, action, score, cfg.num_actions, (local_root->agent_id + 1) % penvs[0].get_num_agents()));
+                local_root->update_value_batch(score, nodes);
             }
             else
             {
-                local_root->child_nodes[action]->update_value_batch(score);
+                nodes.get(local_root->child_nodes[action])->update_value_batch(score, nodes);
             }
         }
+        mark_phase(0, phase_backup);
     }
+    root->zero_snes(nodes);
 }
 
 void MonteCarloTreeSearch::retrieve_statistics(Node* tree, Node* from_root)
 {
     from_root->cnt += tree->cnt;
-    from_root->w += tree->w;
+    from_root->add_w(tree->w);
     int action(0);
-    for(auto c: tree->child_nodes)
+    for(const auto& child: tree->child_nodes)
     {
-        if(c != nullptr)
+        if(Node* c = nodes.get(child))
         {
-            if(from_root->child_nodes[action] == nullptr)
+            if(from_root->child_nodes[action] == 0)
             {
-                from_root->child_nodes[action] = safe_insert_node(from_root, action, 0, cfg.num_actions, c->agent_id);
+                from_root->child_nodes[action] = nodes.handle(safe_insert_node(from_root, action, 0, cfg.num_actions, c->agent_id));
             }
-            retrieve_statistics(c, from_root->child_nodes[action]);
+            retrieve_statistics(c, nodes.get(from_root->child_nodes[action]));
         }
         action++;
     }
@@ -337,30 +763,58 @@ void MonteCarloTreeSearch::tree_parallelization_loop_internal(std::vector<int> p
 {
     for (int i = 0; i < cfg.num_expansions; i++)
     {
+        if (i > 0 && deadline.expired())
+            break;
+        begin_iteration(process_num);
         double score = selection(ptrees[process_num], prev_actions, process_num);
         ptrees[process_num]->update_value(score);
+        mark_phase(process_num, phase_backup);
     }
 }
 
 void MonteCarloTreeSearch::tree_parallelization_loop(std::vector<int>& prev_actions)
 {
-    std::vector<std::future<void>> futures;
-    for(int i = 0; i < cfg.num_parallel_trees; i++)
+    pool.parallel_for(cfg.num_parallel_trees, [&](const int i)
     {
-        futures.push_back(pool.submit(&MonteCarloTreeSearch::tree_parallelization_loop_internal, this, prev_actions, i));
-    }
-    futures[0].get();
+        tree_parallelization_loop_internal(prev_actions, i);
+    });
     for(int i = 1; i < cfg.num_parallel_trees; i++)
     {
-        futures[i].get();
         retrieve_statistics(ptrees[i], root);
     }
-    root->update_q();
 }
 
-std::vector<int> MonteCarloTreeSearch::act()
+void MonteCarloTreeSearch::shared_tree_loop_internal(std::vector<int> prev_actions, const int process_num)
+{
+    while (true)
+    {
+        const int i = expansions_started.fetch_add(1, std::memory_order_relaxed);
+        if (i >= cfg.num_expansions || (i > 0 && deadline.expired()))
+            break;
+        begin_iteration(process_num);
+        double score = selection(root, prev_actions, process_num);
+        root->update_value(score);
+        mark_phase(process_num, phase_backup);
+    }
+}
+
+void MonteCarloTreeSearch::shared_tree_loop(std::vector<int>& prev_actions)
+{
+    expansions_started = 0;
+    pool.parallel_for(cfg.num_shared_workers, [&](const int i)
+    {
+        shared_tree_loop_internal(prev_actions, i);
+    });
+}
+
+std::vector<int> MonteCarloTreeSearch::run_act()
 {
     std::vector<int> actions;
+    reset_search_stats();
+    if (cfg.use_decoupled_uct)
+    {
+        return decoupled_act();
+    }
     if (penvs[0].all_done())
     {
         for(size_t agent_idx = 0; agent_idx < penvs[0].get_num_agents(); agent_idx++)
@@ -370,12 +824,28 @@ std::vector<int> MonteCarloTreeSearch::act()
         return actions;
     }
     std::vector<char> action_names = {'S','U', 'D', 'L', 'R'};
+    const auto act_start = std::chrono::steady_clock::now();
+    int agents_to_search = static_cast<int>(penvs[0].get_num_agents()) - penvs[0].get_num_done();
+    deadline.disable();
     for(size_t agent_idx = 0; agent_idx < penvs[0].get_num_agents(); agent_idx++)
     {
         try
         {
             if (!penvs[0].reached_goal(agent_idx))
             {
+                if (cfg.time_budget_us > 0)
+                {
+                    if (cfg.time_budget_per_agent)
+                    {
+                        deadline.start(cfg.time_budget_us);
+                    }
+                    else
+                    {
+                        const auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - act_start).count();
+                        deadline.start(std::max<int64_t>(cfg.time_budget_us - elapsed, 0) / agents_to_search);
+                    }
+                    agents_to_search--;
+                }
                 if (cfg.batch_size > 1)
                 {
                     batch_loop(actions);
@@ -384,6 +854,10 @@ std::vector<int> MonteCarloTreeSearch::act()
                 {
                     tree_parallelization_loop(actions);
                 }
+                else if (cfg.num_shared_workers > 1)
+                {
+                    shared_tree_loop(actions);
+                }
                 else
                 {
                     loop(actions);
@@ -398,54 +872,210 @@ std::vector<int> MonteCarloTreeSearch::act()
 
         if (cfg.render)
         {
-            std::cout<<agent_idx<<" "<<root->q<<std::endl;
+            std::cout<<agent_idx<<" "<<root->q()<<std::endl;
             for(int i = 0; i < cfg.num_actions; i++) {
-                int cnt = (root->child_nodes[i] == nullptr) ? 0 : root->child_nodes[i]->cnt;
+                int cnt = (root->child_nodes[i] == 0) ? 0 : nodes.get(root->child_nodes[i])->cnt.load();
                 std::cout << action_names[i] << ":" << cnt << " ";
             }
             std::cout<<std::endl;
             for(int i = 0; i < cfg.num_actions; i++) {
-                double c = (root->child_nodes[i] == nullptr) ? 0.0 : uct(root->child_nodes[i], agent_idx, 0);
+                double c = (root->child_nodes[i] == 0) ? 0.0 : uct(nodes.get(root->child_nodes[i]), agent_idx, 0);
                 std::cout << action_names[i] << ":" << c << " ";
             }
             std::cout<<std::endl;
             std::cout<<"---------------------------------------------------------------------\n";
         }
-        int action = root->get_action();
+        const int action = std::max(root->get_action(nodes), 0);
         if (cfg.retrieve_depth_statisticts)
         {
             DepthStatsHandler local_stats;
             local_stats.agent_id = root->agent_id;
             local_stats.cnt = root->cnt;
-            local_stats.q = root->q;
+            local_stats.q = root->q();
             local_stats.action = action;
             local_stats.depth = depth;
             stats.push_back(local_stats);
         }
-        if (first_move)
+        if (first_move && cfg.first_step_stats)
         {
             first_move = false;
             fmstats = get_path(root, 0, 0);
         }
-        root = root->child_nodes[action];
         for(int i = 0; i < cfg.num_parallel_trees; i++)
         {
-            if(ptrees[i]->child_nodes[action] != nullptr)
+            ptrees[i] = advance_root(ptrees[i], action, (agent_idx + 1) % penvs[i].get_num_agents());
+        }
+        root = ptrees[0];
+        actions.push_back(action);
+        depth++;
+    }
+    for(int i = 0; i < num_envs; i++)
+    {
+        penvs[i].step(actions);
+    }
+    collect_search_stats(act_start);
+    if (cfg.render)
+    {
+        for(auto a: actions)
+            std::cout<<a<<" ";
+        std::cout<<" actions\n";
+    }
+    return actions;
+}
+
+void MonteCarloTreeSearch::release_joint_subtree(JointNode* n)
+{
+    std::vector<JointNode*> stack = {n};
+    while (!stack.empty())
+    {
+        JointNode* cur = stack.back();
+        stack.pop_back();
+        for (const auto& child : cur->children)
+        {
+            stack.push_back(child.second);
+        }
+        joint_nodes.destroy(cur);
+    }
+}
+
+int MonteCarloTreeSearch::decoupled_action(const JointNode* n, const int agent_idx, const int process_num) const
+{
+    int best_action(0);
+    double best_score(-1000000);
+    for(int k = 0; k < cfg.num_actions; k++)
+    {
+        if (!cfg.use_move_limits || penvs[process_num].check_action(agent_idx, k, cfg.agents_as_obstacles))
+        {
+            const ActionStats& s = n->stats(agent_idx, k);
+            if (s.cnt == 0)
             {
-                ptrees[i] = ptrees[i]->child_nodes[action];
+                return k;
             }
-            else
+            auto uct_val = s.w/s.cnt + cfg.uct_c*std::sqrt(2.0*std::log(n->cnt)/s.cnt);
+            if (cfg.heuristic_coef > 0)
             {
-                ptrees[i]->child_nodes[action] = safe_insert_node(ptrees[i], action, 0, cfg.num_actions, (agent_idx + 1) % penvs[i].get_num_agents());
+                uct_val += heuristic_bonus(agent_idx, k, process_num) / s.cnt;
+            }
+            if (uct_val > best_score)
+            {
+                best_action = k;
+                best_score = uct_val;
             }
         }
-        actions.push_back(action);
-        depth++;
     }
+    return best_action;
+}
+
+double MonteCarloTreeSearch::decoupled_selection(JointNode* n, const int process_num)
+{
+    Environment& penv = penvs[process_num];
+    std::vector<int> actions(penv.get_num_agents(), 0);
+    for(size_t agent_idx = 0; agent_idx < actions.size(); agent_idx++)
+    {
+        if (!penv.reached_goal(agent_idx))
+        {
+            actions[agent_idx] = decoupled_action(n, agent_idx, process_num);
+        }
+    }
+    const double reward = penv.step(actions);
+    double score = reward;
+    const auto record_leaf = [&]()
+    {
+        if (cfg.collect_stats)
+        {
+            int leaf_depth = 1;
+            for (const JointNode* p = n; p->parent != nullptr; p = p->parent)
+            {
+                leaf_depth++;
+            }
+            thread_stats[process_num].record_depth(leaf_depth);
+            thread_stats[process_num].mark(phase_selection);
+        }
+    };
+    if (penv.all_done())
+    {
+        record_leaf();
+    }
+    else
+    {
+        const uint64_t key = joint_action_key(actions);
+        const auto it = n->children.find(key);
+        if (it == n->children.end())
+        {
+            record_leaf();
+            if (cfg.collect_stats)
+            {
+                thread_stats[process_num].nodes_allocated++;
+            }
+            score += cfg.gamma*simulation(process_num);
+            mark_phase(process_num, phase_rollout);
+            n->children.emplace(key, joint_nodes.create(process_num, n, actions.size()));
+            mark_phase(process_num, phase_expansion);
+        }
+        else
+        {
+            score += cfg.gamma*decoupled_selection(it->second, process_num);
+        }
+    }
+    n->cnt++;
+    for(size_t agent_idx = 0; agent_idx < actions.size(); agent_idx++)
+    {
+        ActionStats& s = n->stats(agent_idx, actions[agent_idx]);
+        s.w += score;
+        s.cnt++;
+    }
+    penv.step_back();
+    return score;
+}
+
+// Decoupled search: every iteration descends whole joint steps, so it gets
+// num_expansions iterations per agent still on its way, like the per-agent loops.
+std::vector<int> MonteCarloTreeSearch::decoupled_act()
+{
+    const size_t num_agents = penvs[0].get_num_agents();
+    std::vector<int> actions(num_agents, 0);
+    if (penvs[0].all_done())
+    {
+        return actions;
+    }
+    const auto act_start = std::chrono::steady_clock::now();
+    const int agents_to_search = static_cast<int>(num_agents) - penvs[0].get_num_done();
+    deadline.disable();
+    if (cfg.time_budget_us > 0)
+    {
+        deadline.start(cfg.time_budget_per_agent ? int64_t(cfg.time_budget_us) * agents_to_search : cfg.time_budget_us);
+    }
+    const int num_iterations = cfg.num_expansions * agents_to_search;
+    for (int i = 0; i < num_iterations; i++)
+    {
+        if (i > 0 && deadline.expired())
+            break;
+        begin_iteration(0);
+        decoupled_selection(joint_root, 0);
+        mark_phase(0, phase_backup);
+    }
+    for(size_t agent_idx = 0; agent_idx < num_agents; agent_idx++)
+    {
+        if (!penvs[0].reached_goal(agent_idx))
+        {
+            actions[agent_idx] = joint_root->most_visited(agent_idx, cfg.num_actions);
+        }
+    }
+    JointNode* next = nullptr;
+    const auto it = joint_root->children.find(joint_action_key(actions));
+    if (it != joint_root->children.end())
+    {
+        next = it->second;
+        joint_root->children.erase(it);
+    }
+    release_joint_subtree(joint_root);
+    joint_root = next != nullptr ? next : joint_nodes.create(0, nullptr, num_agents);
+    joint_root->parent = nullptr;
     for(int i = 0; i < num_envs; i++)
     {
         penvs[i].step(actions);
     }
+    collect_search_stats(act_start);
     if (cfg.render)
     {
         for(auto a: actions)
@@ -463,20 +1093,21 @@ std::vector<DepthStatsHandler> MonteCarloTreeSearch::get_path(Node* n, const int
         DepthStatsHandler local_stats;
         local_stats.agent_id = n->agent_id;
         local_stats.cnt = n->cnt;
-        local_stats.q = n->q;
+        local_stats.q = n->q();
         local_stats.action = n->action_id;
         local_stats.depth = rec_depth;
         local.push_back(local_stats);
-        std::cout<<rec_depth<<"\n";
+        if (cfg.render)
+            std::cout<<rec_depth<<"\n";
         return local;
     }
     std::vector<DepthStatsHandler> child_results;
     bool ok = false;
-    for (const auto child: n->child_nodes)
+    for (const auto& child: n->child_nodes)
     {
-        if (child != nullptr)
+        if (child != 0)
         {
-            auto result = get_path(child, process_num, rec_depth + 1);
+            auto result = get_path(nodes.get(child), process_num, rec_depth + 1);
             ok = ok | (result.size() > 0);
             child_results.insert( child_results.end(), result.begin(), result.end() );
         }
@@ -486,11 +1117,12 @@ std::vector<DepthStatsHandler> MonteCarloTreeSearch::get_path(Node* n, const int
         DepthStatsHandler local_stats;
         local_stats.agent_id = n->agent_id;
         local_stats.cnt = n->cnt;
-        local_stats.q = n->q;
+        local_stats.q = n->q();
         local_stats.action = n->action_id;
         local_stats.depth = rec_depth;
         local.push_back(local_stats);
-        std::cout<<rec_depth<<" out\n";
+        if (cfg.render)
+            std::cout<<rec_depth<<" out\n";
         local.insert( local.end(), child_results.begin(), child_results.end() );
     }
     return local;
@@ -498,81 +1130,158 @@ std::vector<DepthStatsHandler> MonteCarloTreeSearch::get_path(Node* n, const int
 
 void MonteCarloTreeSearch::set_config(const Config& config)
 {
+    const auto lock = lock_idle();
     cfg = config;
 }
 
-void MonteCarloTreeSearch::set_env(Environment env, const int obs_radius_)
+void MonteCarloTreeSearch::sync_positions(const int32_t* positions)
 {
-    for(int i = 0; i < cfg.num_parallel_trees; i++)
+    const auto lock = lock_idle();
+    if (penvs.empty() || penvs[0].same_positions(positions))
     {
-        ptrees.push_back(safe_insert_node(nullptr, -1, 0, cfg.num_actions, 0));
+        return;
     }
-    num_envs = std::max({cfg.num_parallel_trees, cfg.batch_size, cfg.multi_simulations});
-    for(int i = 0; i < num_envs; i++)
+    for (auto& penv : penvs)
     {
-        penvs.push_back(env);
+        penv.sync_positions(positions);
+    }
+    for (auto& tree : ptrees)
+    {
+        release_subtree(tree);
+        tree = safe_insert_node(nullptr, -1, 0, cfg.num_actions, 0);
     }
     root = ptrees[0];
-    if (cfg.heuristic_coef > 0)
+    transpositions.clear();
+    if (joint_root != nullptr)
     {
-        shortest_paths = bfs(env);
+        release_joint_subtree(joint_root);
+        joint_root = joint_nodes.create(0, nullptr, penvs[0].get_num_agents());
     }
-    obs_radius = obs_radius_;
 }
 
-std::vector<std::vector<std::vector<double>>> MonteCarloTreeSearch::bfs(Environment& env)
+void MonteCarloTreeSearch::set_env(Environment env, const int obs_radius_)
 {
-    auto obstacles = env.grid;
-
-    std::vector<std::vector<std::vector<double>>> agents_map(env.num_agents, std::vector(obstacles.size(), std::vector<double>(obstacles.size())));
-    agents_map.reserve(env.num_agents);
-
-    for(size_t i = 0; i < env.num_agents; i++)
+    const auto lock = lock_idle();
+    ptrees.clear();
+    penvs.clear();
+    nodes.clear();
+    num_envs = std::max({cfg.num_parallel_trees, cfg.batch_size, cfg.num_shared_workers, 1});
+    const int num_lanes = cfg.multi_simulations > 1 ? num_envs * (cfg.multi_simulations - 1) : 0;
+    nodes.resize(num_envs);
+    joint_nodes.clear();
+    joint_nodes.resize(num_envs);
+    joint_root = cfg.use_decoupled_uct ? joint_nodes.create(0, nullptr, env.get_num_agents()) : nullptr;
+    thread_stats.assign(num_envs, ThreadStats());
+    for(int i = 0; i < cfg.num_parallel_trees; i++)
     {
-        std::vector<std::vector<double>> filled(obstacles.size(), std::vector<double>(obstacles.size()));
-        for(size_t j = 0; j < filled.size(); j++)
+        ptrees.push_back(safe_insert_node(nullptr, -1, 0, cfg.num_actions, 0));
+    }
+    for(int i = 0; i < num_envs + num_lanes; i++)
+    {
+        penvs.push_back(env);
+    }
+    workspaces.assign(penvs.size(), RolloutWorkspace());
+    const uint64_t seed = cfg.seed < 0 ? std::chrono::system_clock::now().time_since_epoch().count() : cfg.seed;
+    for(int i = 0; i < static_cast<int>(penvs.size()); i++)
+    {
+        penvs[i].set_seed_stream(seed, i);
+        workspaces[i].batch.seed(splitmix64(seed) ^ splitmix64(~uint64_t(i)));
+    }
+    root = ptrees[0];
+    first_move = true;
+    depth = 0;
+    stats.clear();
+    fmstats.clear();
+    transpositions.resize(cfg.use_transpositions ? cfg.transposition_table_log2 : -1);
+    goal_distances.clear();
+    if (cfg.heuristic_coef > 0 || cfg.use_replansim || cfg.rollout_value_coef > 0 || cfg.rollout_stagnation_steps > 0)
+    {
+        distance_fields.set_map(env.grid);
+        const std::string store = cfg.distance_field_dir.empty() ? "" : distance_fields.store_path(cfg.distance_field_dir);
+        if (!store.empty() && !distance_fields.contains_all(env.goals))
         {
-            for(size_t k = 0; k < filled[0].size(); k++)
-            {
-                if(obstacles[j][k] >= 0)
-                {
-                    filled[j].push_back(1000000);
-                }
-            }
+            distance_fields.load(store);
         }
-        filled[env.goals[i].first][env.goals[i].second] = 0;
-        std::deque<std::pair<int, int>> q;
-        q.push_back(env.goals[i]);
-        while (q.size() > 0)
+        const size_t num_cached = distance_fields.size();
+        distance_fields.prepare(env.goals, &pool);
+        if (!store.empty() && distance_fields.size() > num_cached)
         {
-            auto pos = q.front();
-            q.pop_front();
-            for(const auto& move: env.moves)
-            {
-                if ((pos.first + move.first >= 0) && (static_cast<size_t>(pos.first + move.first) < filled.size())\
-                         && (pos.second + move.second >= 0) && (static_cast<size_t>(pos.second + move.second) < filled[0].size()))
-                {
-                    if ((filled[pos.first + move.first][pos.second + move.second] == 1000000) && env.grid[pos.first + move.first][pos.second + move.second] != 1)
-                    {
-                        q.push_back(std::make_pair(pos.first + move.first, pos.second + move.second));
-                        filled[pos.first + move.first][pos.second + move.second] = filled[pos.first][pos.second] + 1;
-                    }
-                }
-            }
+            distance_fields.save(store);
+        }
+        for (const auto& goal : env.goals)
+        {
+            goal_distances.push_back(distance_fields.get(goal));
         }
-        agents_map.push_back(filled);
     }
-    return agents_map;
+    obs_radius = obs_radius_;
 }
 
 PYBIND11_MODULE(mcts, m) {
     py::class_<MonteCarloTreeSearch>(m, "MonteCarloTreeSearch")
             .def(py::init<>())
-            .def("act", &MonteCarloTreeSearch::act)
-            .def("set_config", &MonteCarloTreeSearch::set_config)
-            .def("set_env", &MonteCarloTreeSearch::set_env)
-            .def_readwrite("stats", &MonteCarloTreeSearch::stats)
-            .def_readwrite("fmstats", &MonteCarloTreeSearch::fmstats)
+            .def("act", &MonteCarloTreeSearch::act, py::call_guard<py::gil_scoped_release>())
+            .def("act_async", &MonteCarloTreeSearch::act_async, py::keep_alive<0, 1>())
+            .def("set_config", &MonteCarloTreeSearch::set_config, py::call_guard<py::gil_scoped_release>())
+            .def("set_env", &MonteCarloTreeSearch::set_env, py::call_guard<py::gil_scoped_release>())
+            .def("sync_positions", [](MonteCarloTreeSearch& mcts, const positions_array& positions)
+            {
+                size_t num_agents;
+                {
+                    py::gil_scoped_release release;
+                    num_agents = mcts.get_num_agents();
+                }
+                check_positions(positions, num_agents, "positions");
+                py::gil_scoped_release release;
+                mcts.sync_positions(positions.data());
+            })
+            .def("wait", &MonteCarloTreeSearch::wait_pending_search, py::call_guard<py::gil_scoped_release>())
+            .def("get_num_agents", &MonteCarloTreeSearch::get_num_agents, py::call_guard<py::gil_scoped_release>())
+            .def("get_num_nodes", &MonteCarloTreeSearch::get_num_nodes, py::call_guard<py::gil_scoped_release>())
+            .def("get_nodes_bytes", &MonteCarloTreeSearch::get_nodes_bytes, py::call_guard<py::gil_scoped_release>())
+            .def("get_reserved_bytes", &MonteCarloTreeSearch::get_reserved_bytes, py::call_guard<py::gil_scoped_release>())
+            .def("get_search_stats", &MonteCarloTreeSearch::get_search_stats, py::call_guard<py::gil_scoped_release>())
+            .def_property("stats", [](const MonteCarloTreeSearch& mcts)
+            {
+                py::gil_scoped_release release;
+                const auto lock = mcts.lock_idle();
+                return mcts.stats;
+            }, [](MonteCarloTreeSearch& mcts, const std::vector<DepthStatsHandler>& stats)
+            {
+                py::gil_scoped_release release;
+                const auto lock = mcts.lock_idle();
+                mcts.stats = stats;
+            })
+            .def_property("fmstats", [](const MonteCarloTreeSearch& mcts)
+            {
+                py::gil_scoped_release release;
+                const auto lock = mcts.lock_idle();
+                return mcts.fmstats;
+            }, [](MonteCarloTreeSearch& mcts, const std::vector<DepthStatsHandler>& fmstats)
+            {
+                py::gil_scoped_release release;
+                const auto lock = mcts.lock_idle();
+                mcts.fmstats = fmstats;
+            })
+            ;
+    py::class_<SearchFuture>(m, "SearchFuture")
+            .def("result", &SearchFuture::result, py::call_guard<py::gil_scoped_release>())
+            .def("done", &SearchFuture::done)
+            ;
+    py::class_<SearchStats>(m, "SearchStats")
+            .def_readonly("act_ms", &SearchStats::act_ms)
+            .def_readonly("selection_ms", &SearchStats::selection_ms)
+            .def_readonly("expansion_ms", &SearchStats::expansion_ms)
+            .def_readonly("rollout_ms", &SearchStats::rollout_ms)
+            .def_readonly("backup_ms", &SearchStats::backup_ms)
+            .def_readonly("pool_wait_ms", &SearchStats::pool_wait_ms)
+            .def_readonly("pool_tasks", &SearchStats::pool_tasks)
+            .def_readonly("iterations", &SearchStats::iterations)
+            .def_readonly("rollouts", &SearchStats::rollouts)
+            .def_readonly("nodes_allocated", &SearchStats::nodes_allocated)
+            .def_readonly("insert_races", &SearchStats::insert_races)
+            .def_readonly("tt_misses", &SearchStats::tt_misses)
+            .def_readonly("nodes_live", &SearchStats::nodes_live)
+            .def_readonly("depth_histogram", &SearchStats::depth_histogram)
             ;
     py::class_<DepthStatsHandler>(m, "DepthStatsHandler")
             .def(py::init<>())
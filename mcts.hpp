@@ -1,4 +1,4 @@
-#include "BS_thread_pool.hpp"
+#include "work_stealing_pool.hpp"
 #include <iostream>
 #include <list>
 #include <vector>
@@ -6,10 +6,17 @@
 #include <cmath>
 #include <string>
 #include <chrono>
+#include <optional>
+#include <future>
+#include <mutex>
 #include <unordered_map>
 #include "config.cpp"
 #include "node.hpp"
+#include "node_pool.hpp"
+#include "joint_node.hpp"
 #include "replan.cpp"
+#include "distance_fields.hpp"
+#include "search_stats.hpp"
 
 class DepthStatsHandler
 {
@@ -21,46 +28,188 @@ class DepthStatsHandler
     int depth;
 };
 
+class RolloutWorkspace
+{
+public:
+    std::vector<int> actions;
+    // RePlan rollout policy of this thread, built on first use and reset per rollout.
+    std::optional<RePlan> replan;
+    // lanes of the lockstep random rollouts
+    EnvironmentBatch batch;
+    // states that rollouts and batch paths return to
+    EnvironmentSnapshot rollout_start;
+    EnvironmentSnapshot path_start;
+};
+
+class SearchDeadline
+{
+    std::chrono::steady_clock::time_point end;
+    bool enabled = false;
+
+public:
+    void start(const int64_t budget_us)
+    {
+        end = std::chrono::steady_clock::now() + std::chrono::microseconds(budget_us);
+        enabled = true;
+    }
+
+    void disable()
+    {
+        enabled = false;
+    }
+
+    bool expired() const
+    {
+        return enabled && std::chrono::steady_clock::now() >= end;
+    }
+};
+
+// Result of act_async(). result() blocks until the search has finished and
+// returns the actions, or rethrows what the search threw.
+class SearchFuture
+{
+    std::shared_future<std::vector<int>> result_;
+
+public:
+    explicit SearchFuture(std::shared_future<std::vector<int>> result) : result_(std::move(result)) {}
+
+    std::vector<int> result() const
+    {
+        return result_.get();
+    }
+
+    bool done() const
+    {
+        return result_.wait_for(std::chrono::seconds(0)) == std::future_status::ready;
+    }
+};
+
 class MonteCarloTreeSearch
 {
     Node* root;
-    std::list<Node> all_nodes;
+    NodePool<Node> nodes;
+    std::vector<Node*> gc_stack;
     std::list<Environment> all_envs;
     Config cfg;
-    BS::thread_pool pool;
+    WorkStealingPool pool;
     std::vector<Node*> ptrees;
+    // one environment and workspace per process_num, followed by the
+    // multi_simulations - 1 private rollout lanes of each of them
     std::vector<Environment> penvs;
+    std::vector<RolloutWorkspace> workspaces;
     int num_envs;
-    std::vector<std::vector<std::vector<double>>> shortest_paths;
+    std::atomic<int> expansions_started = 0;
+    SearchDeadline deadline;
+    DistanceFieldCache distance_fields;
+    std::vector<const uint16_t*> goal_distances;
     int obs_radius;
     bool first_move = true;
+    // guards pending_search, which act_async() replaces while other threads wait on it
+    mutable std::mutex pending_mutex;
+    std::shared_future<std::vector<int>> pending_search;
+    // held by a running search and by public methods while they use the search state
+    mutable std::mutex search_mutex;
+    // per-thread telemetry, indexed by process_num and filled only with cfg.collect_stats
+    std::vector<ThreadStats> thread_stats;
+    SearchStats search_stats;
+    TranspositionTable transpositions;
+    // tree of the decoupled search, used instead of ptrees with cfg.use_decoupled_uct
+    NodePool<JointNode> joint_nodes;
+    JointNode* joint_root = nullptr;
 
 public:
     Environment env;
 
     explicit MonteCarloTreeSearch();
 
+    // Limits the search thread pool to num_threads workers.
+    explicit MonteCarloTreeSearch(unsigned num_threads);
+
+    ~MonteCarloTreeSearch();
+
     std::vector<int> act();
 
+    // Runs act() on a background thread. Searches started this way run in call
+    // order, and every other public method waits for them to finish.
+    SearchFuture act_async();
+
+    // Blocks until the searches started by act_async() have finished.
+    void wait_pending_search() const;
+
+    // Waits like wait_pending_search() and returns a lock that keeps searches
+    // started later from running until it is released.
+    std::unique_lock<std::mutex> lock_idle() const;
+
     void set_env(Environment env_, const int obs_radius_);
 
     void set_config(const Config& config);
 
+    // Moves the agents to positions (num_agents x 2, row-major). If they differ
+    // from where the last act() left them, the search trees start over.
+    void sync_positions(const int32_t* positions);
+
+    size_t get_num_agents() const;
+
+    size_t get_num_nodes() const;
+
+    size_t get_nodes_bytes() const;
+
+    size_t get_reserved_bytes() const;
+
+    // Telemetry of the last act(), empty unless Config.collect_stats is set.
+    SearchStats get_search_stats() const;
+
     std::vector<DepthStatsHandler> stats;
     std::vector<DepthStatsHandler> fmstats;
 
     int depth;
 
 protected:
-    Node* safe_insert_node(Node* n, const int action, const double score, const int num_actions, const int next_agent_idx);
+    std::vector<int> run_act();
+
+    Environment& search_env(const int process_num);
+
+    void begin_iteration(const int process_num);
+
+    void mark_phase(const int process_num, const SearchPhase phase);
+
+    void record_leaf_depth(const Node* n, const int process_num);
+
+    void reset_search_stats();
+
+    void collect_search_stats(const std::chrono::steady_clock::time_point act_start);
+
+    Node* safe_insert_node(Node* n, const int action, const double score, const int num_actions, const int next_agent_idx, const int process_num = 0);
+
+    bool insert_child(Node* n, const int action, const double score, const int next_agent_idx, const int process_num);
+
+    void release_subtree(Node* n);
+
+    Node* advance_root(Node* n, const int action, const int next_agent_idx);
 
     double single_simulation(const int process_num);
 
+    int rollout_lane(const int process_num, const int lane) const;
+
+    int64_t remaining_distance(const Environment& penv) const;
+
+    int64_t remaining_distance(const EnvironmentBatch& batch) const;
+
+    double truncated_value(const Environment& penv) const;
+
+    double truncated_value(const EnvironmentBatch& batch) const;
+
+    double lockstep_simulation(const int process_num);
+
     double simulation(const int process_num);
 
-    double uct(Node* n, const int agent_idx, const int process_num) const;
+    void link_transposition(Node* n, const uint64_t hash_before, const uint64_t hash_after, const int process_num);
+
+    double heuristic_bonus(const int agent_idx, const int action, const int process_num) const;
 
-    double batch_uct(Node* n) const;
+    double uct(const Node* n, const int agent_idx, const int process_num) const;
+
+    double batch_uct(const Node* n) const;
 
     int expansion(Node* n, const int agent_idx, const int process_num) const;
 
@@ -82,7 +231,17 @@ protected:
 
     void tree_parallelization_loop(std::vector<int>& prev_actions);
 
-    std::vector<std::vector<std::vector<double>>> bfs(Environment& env);
+    void shared_tree_loop_internal(std::vector<int> prev_actions, const int process_num);
+
+    void shared_tree_loop(std::vector<int>& prev_actions);
+
+    void release_joint_subtree(JointNode* n);
+
+    int decoupled_action(const JointNode* n, const int agent_idx, const int process_num) const;
+
+    double decoupled_selection(JointNode* n, const int process_num);
+
+    std::vector<int> decoupled_act();
 
     std::vector<DepthStatsHandler> get_path(Node* n, const int process_num, int rec_depth);
 };
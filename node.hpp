@@ -1,102 +1,119 @@
-#include <list>
-#include <vector>
+#pragma once
+#include <atomic>
+#include <cassert>
+#include <cstdint>
+#include "node_pool.hpp"
+#include "transposition_table.hpp"
 
+constexpr int max_actions = 5;
+
+inline void atomic_add(std::atomic<double>& target, const double value)
+{
+    double expected = target.load(std::memory_order_relaxed);
+    while (!target.compare_exchange_weak(expected, expected + value, std::memory_order_relaxed))
+    {
+    }
+}
+
+// handle of a node in NodePool<Node>, 0 for none
+using NodeHandle = uint32_t;
+
+// 56 bytes with no heap blocks: the parent and the children are 32-bit handles
+// into the node pool, kept in a fixed inline array (the action space is at most
+// five moves), and the picked-in-batch flags are a bitmask. Statistics and child
+// links are atomic so that shared-tree workers can update them concurrently;
+// cnt_sne doubles as the virtual loss of in-flight workers. tt links nodes that
+// step the environment to their transposition table entry.
 class Node
 {
 public:
-    int action_id;
-    Node* parent;
-    uint64_t cnt;
-    double w;
-    double q;
-    std::vector<Node*> child_nodes;
-    int agent_id;
-    uint64_t cnt_sne;
-    std::vector<bool> mask_picked;
-    int num_actions_;
-    size_t num_succeeded;
+    std::atomic<double> w;
+    std::atomic<uint32_t> cnt;
+    std::atomic<uint32_t> cnt_sne;
+    NodeHandle parent;
+    std::atomic<NodeHandle> child_nodes[max_actions];
+    std::atomic<TTLink> tt;
+    int16_t agent_id;
+    std::atomic<uint16_t> num_succeeded;
+    int8_t action_id;
+    uint8_t num_actions_;
+    uint8_t mask_picked;
 
-    Node(Node* _parent, int _action_id, double _w, int num_actions, int _agent_id=-1)
-            : action_id(_action_id), parent(_parent), w(_w), agent_id(_agent_id), num_succeeded(0)
+    Node(NodeHandle _parent, int _action_id, double _w, int num_actions, int _agent_id=-1)
+            : w(_w), cnt(1), cnt_sne(0), parent(_parent), tt(0), agent_id(_agent_id), num_succeeded(0),
+              action_id(_action_id), num_actions_(num_actions), mask_picked(0)
     {
-        cnt = 1;
-        q = w;
-        num_actions_ = num_actions;
-        child_nodes.resize(num_actions, nullptr);
-        zero_snes();
+        assert(num_actions <= max_actions);
+        for (auto& child : child_nodes)
+        {
+            child.store(0, std::memory_order_relaxed);
+        }
     }
 
-    void update_value(double value)
+    void add_w(double value)
     {
-        w += value;
-        cnt++;
-        q = w/cnt;
+        atomic_add(w, value);
     }
 
-    void update_value_batch(double value)
+    double q() const
     {
-        w += value;
-        cnt++;
-        q = w/cnt;
-        if (parent != nullptr)
-        {
-            parent->update_value_batch(value);
-        }
+        return w.load(std::memory_order_relaxed)/cnt.load(std::memory_order_relaxed);
     }
 
-    int get_action()
+    bool is_picked(const int action) const
     {
-        int best_action(0), k(0);
-        uint64_t best_score = 0;
-        for(auto c: child_nodes)
-        {
-            if (c != nullptr)
-            {
-                if (c->cnt > best_score)
-                {
-                    best_action = k;
-                    best_score = c->cnt;
-                }
-            }
-            k++;
-        }
-        while((child_nodes[best_action] == nullptr) && (best_action < num_actions_))
-        {
-            best_action++;
-        }
-        if(best_action >= num_actions_)
-        {
-            return -1;
-        }
-        else
+        return (mask_picked >> action) & 1;
+    }
+
+    void set_picked(const int action)
+    {
+        mask_picked |= 1 << action;
+    }
+
+    void update_value(double value)
+    {
+        add_w(value);
+        cnt.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void update_value_batch(double value, const NodePool<Node>& pool)
+    {
+        add_w(value);
+        cnt.fetch_add(1, std::memory_order_relaxed);
+        if (parent != 0)
         {
-            return best_action;
+            pool.get(parent)->update_value_batch(value, pool);
         }
     }
 
-    void zero_snes()
+    int get_action(const NodePool<Node>& pool) const
     {
-        cnt_sne = 0;
-        mask_picked.clear();
-        mask_picked.resize(num_actions_, false);
-        for (auto child : child_nodes)
+        int best_action(-1);
+        uint32_t best_score = 0;
+        for(int k = 0; k < num_actions_; k++)
         {
-            if (child)
+            const Node* c = pool.get(child_nodes[k]);
+            if (c != nullptr && (best_action < 0 || c->cnt > best_score))
             {
-                child->zero_snes();
+                best_action = k;
+                best_score = c->cnt;
             }
         }
+        return best_action;
     }
 
-    void update_q()
+    void zero_snes(const NodePool<Node>& pool)
     {
-        q = w/cnt;
-        for(auto child: child_nodes)
+        cnt_sne = 0;
+        mask_picked = 0;
+        for(int k = 0; k < num_actions_; k++)
         {
-            if(child)
+            if (Node* c = pool.get(child_nodes[k]))
             {
-                child->update_q();
+                c->zero_snes(pool);
             }
         }
     }
 };
+
+static_assert(sizeof(Node) == 56, "Node layout changed");
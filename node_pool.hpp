@@ -0,0 +1,251 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+// Chunked arena for tree nodes. Every search thread owns one slot (indexed by
+// process_num) and bump-allocates from its own chunks, so expansions take no
+// lock and only touch the heap once per chunk. Chunks are aligned to their size,
+// which lets destroy() find the owning slot of any node from its address and
+// put the cell back on that slot's free list for reuse.
+// A cell can also be named by a 32-bit handle (slot, chunk and cell index, plus
+// one so that 0 stays null), which lets nodes link to each other in half the
+// space of a pointer.
+template<typename T, size_t ChunkBytes = (size_t(1) << 19)>
+class NodePool
+{
+public:
+    using Handle = uint32_t;
+
+private:
+    union Cell
+    {
+        Cell* next;
+        alignas(T) unsigned char data[sizeof(T)];
+    };
+
+    struct ChunkHeader
+    {
+        uint32_t slot;
+        uint32_t index;
+        size_t used;
+    };
+
+    static constexpr size_t header_bytes = (sizeof(ChunkHeader) + alignof(Cell) - 1) / alignof(Cell) * alignof(Cell);
+    static constexpr size_t chunk_capacity = (ChunkBytes - header_bytes) / sizeof(Cell);
+    static_assert((ChunkBytes & (ChunkBytes - 1)) == 0, "chunk size must be a power of two");
+    static_assert(chunk_capacity > 0, "chunk too small for the node type");
+
+    static constexpr unsigned bit_width(size_t x)
+    {
+        return x == 0 ? 0 : 1 + bit_width(x >> 1);
+    }
+
+    // Cell indices stay below 2^cell_bits - 1, so no encoded cell is ~0u and the
+    // +1 of a handle never wraps to 0.
+    static constexpr unsigned slot_bits = 6;
+    static constexpr unsigned cell_bits = bit_width(chunk_capacity);
+    static constexpr unsigned chunk_bits = 32 - slot_bits - cell_bits;
+    static constexpr size_t max_slots = size_t(1) << slot_bits;
+    static constexpr size_t max_chunks = size_t(1) << chunk_bits;
+    static_assert(cell_bits + slot_bits < 32, "chunk too large for 32-bit handles");
+
+    struct ChunkDeleter
+    {
+        void operator()(ChunkHeader* chunk) const
+        {
+            ::operator delete(chunk, std::align_val_t(ChunkBytes));
+        }
+    };
+
+    // The chunk table has a fixed capacity of max_chunks, so get() can read it
+    // from any thread while the owner appends chunks.
+    struct alignas(64) Slot
+    {
+        std::unique_ptr<std::unique_ptr<ChunkHeader, ChunkDeleter>[]> chunks;
+        size_t num_chunks = 0;
+        Cell* free_list = nullptr;
+        size_t num_live = 0;
+    };
+
+    std::vector<Slot> slots;
+
+    static Cell* cells(ChunkHeader* chunk)
+    {
+        return reinterpret_cast<Cell*>(reinterpret_cast<unsigned char*>(chunk) + header_bytes);
+    }
+
+    static ChunkHeader* owner(const void* p)
+    {
+        return reinterpret_cast<ChunkHeader*>(reinterpret_cast<uintptr_t>(p) & ~(uintptr_t(ChunkBytes) - 1));
+    }
+
+    Cell* take(const size_t slot_idx)
+    {
+        Slot& slot = slots[slot_idx];
+        if (slot.free_list != nullptr)
+        {
+            Cell* cell = slot.free_list;
+            slot.free_list = cell->next;
+            return cell;
+        }
+        if (slot.num_chunks == 0 || slot.chunks[slot.num_chunks - 1]->used == chunk_capacity)
+        {
+            if (slot.num_chunks == max_chunks)
+            {
+                throw std::bad_alloc();
+            }
+            if (!slot.chunks)
+            {
+                slot.chunks = std::make_unique<std::unique_ptr<ChunkHeader, ChunkDeleter>[]>(max_chunks);
+            }
+            auto* chunk = static_cast<ChunkHeader*>(::operator new(ChunkBytes, std::align_val_t(ChunkBytes)));
+            chunk->slot = static_cast<uint32_t>(slot_idx);
+            chunk->index = static_cast<uint32_t>(slot.num_chunks);
+            chunk->used = 0;
+            slot.chunks[slot.num_chunks++].reset(chunk);
+        }
+        ChunkHeader* chunk = slot.chunks[slot.num_chunks - 1].get();
+        return &cells(chunk)[chunk->used++];
+    }
+
+public:
+    explicit NodePool(const size_t num_slots = 1)
+    {
+        resize(num_slots);
+    }
+
+    NodePool(const NodePool&) = delete;
+    NodePool& operator=(const NodePool&) = delete;
+
+    ~NodePool()
+    {
+        clear();
+    }
+
+    // Not thread-safe: call only while no search is running.
+    void resize(const size_t num_slots)
+    {
+        if (num_slots > max_slots)
+        {
+            throw std::length_error("NodePool supports at most " + std::to_string(max_slots) + " slots");
+        }
+        if (num_slots > slots.size())
+        {
+            slots.resize(num_slots);
+        }
+    }
+
+    size_t num_slots() const
+    {
+        return slots.size();
+    }
+
+    Handle handle(const T* p) const
+    {
+        if (p == nullptr)
+        {
+            return 0;
+        }
+        const ChunkHeader* chunk = owner(p);
+        const size_t cell = (reinterpret_cast<const unsigned char*>(p) - reinterpret_cast<const unsigned char*>(chunk) - header_bytes) / sizeof(Cell);
+        return static_cast<Handle>((((size_t(chunk->slot) << chunk_bits) | chunk->index) << cell_bits | cell) + 1);
+    }
+
+    T* get(const Handle h) const
+    {
+        if (h == 0)
+        {
+            return nullptr;
+        }
+        const Handle x = h - 1;
+        ChunkHeader* chunk = slots[x >> (chunk_bits + cell_bits)].chunks[(x >> cell_bits) & (max_chunks - 1)].get();
+        return std::launder(reinterpret_cast<T*>(cells(chunk)[x & ((Handle(1) << cell_bits) - 1)].data));
+    }
+
+    template<typename... Args>
+    T* create(const size_t slot_idx, Args&&... args)
+    {
+        Cell* cell = take(slot_idx);
+        slots[slot_idx].num_live++;
+        return new (cell->data) T(std::forward<Args>(args)...);
+    }
+
+    // Returns the node to the free list of the slot that allocated it. Only the
+    // owning thread may call this during a search; otherwise call it while idle.
+    void destroy(T* p)
+    {
+        p->~T();
+        Slot& slot = slots[owner(p)->slot];
+        Cell* cell = reinterpret_cast<Cell*>(p);
+        cell->next = slot.free_list;
+        slot.free_list = cell;
+        slot.num_live--;
+    }
+
+    void clear()
+    {
+        for (auto& slot : slots)
+        {
+            if constexpr (!std::is_trivially_destructible_v<T>)
+            {
+                std::unordered_set<Cell*> released;
+                for (Cell* cell = slot.free_list; cell != nullptr; cell = cell->next)
+                {
+                    released.insert(cell);
+                }
+                for (size_t c = 0; c < slot.num_chunks; c++)
+                {
+                    ChunkHeader* chunk = slot.chunks[c].get();
+                    for (size_t i = 0; i < chunk->used; i++)
+                    {
+                        Cell* cell = &cells(chunk)[i];
+                        if (released.count(cell) == 0)
+                        {
+                            std::launder(reinterpret_cast<T*>(cell->data))->~T();
+                        }
+                    }
+                }
+            }
+            for (size_t c = 0; c < slot.num_chunks; c++)
+            {
+                slot.chunks[c].reset();
+            }
+            slot.num_chunks = 0;
+            slot.free_list = nullptr;
+            slot.num_live = 0;
+        }
+    }
+
+    size_t num_live() const
+    {
+        size_t total = 0;
+        for (const auto& slot : slots)
+        {
+            total += slot.num_live;
+        }
+        return total;
+    }
+
+    size_t bytes_live() const
+    {
+        return num_live() * sizeof(T);
+    }
+
+    size_t bytes_reserved() const
+    {
+        size_t total = 0;
+        for (const auto& slot : slots)
+        {
+            total += slot.num_chunks * ChunkBytes;
+        }
+        return total;
+    }
+};
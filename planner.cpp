@@ -3,10 +3,10 @@
 #include <pybind11/stl.h>
 #include <pybind11/stl_bind.h>
 #include <vector>
-#include <queue>
+#include <functional>
 #include <cmath>
-#include <set>
-#include <map>
+#include <algorithm>
+#include <cstdint>
 #include <list>
 #define INF 1000000000
 namespace py = pybind11;
@@ -42,104 +42,243 @@ struct PlannerNode {
     }
 };
 
+// A* over a dense grid. Known obstacles, visible agents and the search state
+// are flat arrays indexed by cell; generation stamps make resetting them O(1).
+// Cells outside the map size (set explicitly or grown to cover every
+// coordinate seen so far) are treated as blocked.
+// With path reuse enabled, a plan that reached the goal is kept across calls:
+// while the agent stays on it and its remainder is still free, update_path()
+// drops the prefix instead of searching again.
 class planner {
-    std::set<std::pair<int,int>> obstacles;
-    std::set<std::pair<int,int>> other_agents;
-    std::set<std::pair<int,int>> bad_actions;
-    std::priority_queue<PlannerNode, std::vector<PlannerNode>, std::greater<PlannerNode>> OPEN;
-    std::map<std::pair<int, int>, std::pair<int, int>> CLOSED;
+    int height = 0;
+    int width = 0;
+    std::vector<uint8_t> obstacles;
+    std::vector<uint32_t> other_agents;
+    uint32_t agents_stamp = 1;
+    std::vector<std::pair<int,int>> bad_actions;
+    std::vector<uint32_t> closed;
+    std::vector<int> parents;
+    uint32_t search_stamp = 0;
+    std::vector<PlannerNode> OPEN;
     std::pair<int, int> start;
-    std::pair<int, int> desired_position;
+    std::pair<int, int> desired_position = {INF, INF};
     std::pair<int, int> goal;
     PlannerNode best_node;
     int max_steps;
+    bool reuse_paths;
+    std::vector<int> plan;
+    size_t plan_start = 0;
+    bool plan_reaches_goal = false;
+    bool plan_is_shortest = false;
+    int pruned_f = INF;
+    const uint16_t* goal_distances = nullptr;
+    int distances_height = 0;
+    int distances_width = 0;
     inline int h(std::pair<int, int> n)
     {
+        if(goal_distances != nullptr and n.first >= 0 and n.first < distances_height and n.second >= 0 and n.second < distances_width)
+            return goal_distances[n.first * distances_width + n.second];
         return std::abs(n.first - goal.first) + std::abs(n.second - goal.second);
     }
-    std::vector<std::pair<int,int>> get_neighbors(std::pair<int, int> node)
+    inline bool in_map(std::pair<int, int> n) const
     {
-        std::vector<std::pair<int,int>> neighbors;
-        std::vector<std::pair<int,int>> deltas = {{0,1},{1,0},{-1,0},{0,-1}};
-        for(auto d:deltas)
-        {
-            std::pair<int,int> n(node.first + d.first, node.second + d.second);
-            if(obstacles.count(n) == 0)
-                neighbors.push_back(n);
-        }
-        return neighbors;
+        return n.first >= 0 and n.first < height and n.second >= 0 and n.second < width;
+    }
+    inline int cell(std::pair<int, int> n) const
+    {
+        return n.first * width + n.second;
+    }
+    inline std::pair<int, int> position(int c) const
+    {
+        return {c / width, c % width};
+    }
+    void ensure_size(std::pair<int, int> n)
+    {
+        if(n.first >= height or n.second >= width)
+            set_map_size(std::max(height, n.first + 1), std::max(width, n.second + 1));
     }
     void compute_shortest_path()
     {
+        static constexpr int deltas[4][2] = {{0,1},{1,0},{-1,0},{0,-1}};
         PlannerNode current;
         int steps = 0;
         while(!OPEN.empty() and steps < max_steps and !(current == goal))
         {
-            current = OPEN.top();
-            OPEN.pop();
+            std::pop_heap(OPEN.begin(), OPEN.end(), std::greater<PlannerNode>());
+            current = OPEN.back();
+            OPEN.pop_back();
             if(current.h < best_node.h)
                 best_node = current;
             steps++;
-            for(auto n: get_neighbors({current.i, current.j})) {
-                if (CLOSED.find(n) == CLOSED.end() and other_agents.find(n) == other_agents.end()) {
-                    OPEN.push(PlannerNode(n.first, n.second, current.g + 1, h(n)));
-                    CLOSED[n] = {current.i, current.j};
+            const int parent = cell({current.i, current.j});
+            for(const auto& d: deltas)
+            {
+                const std::pair<int, int> n(current.i + d[0], current.j + d[1]);
+                if(!in_map(n))
+                    continue;
+                const int c = cell(n);
+                if(obstacles[c] or closed[c] == search_stamp)
+                    continue;
+                if(other_agents[c] == agents_stamp)
+                {
+                    pruned_f = std::min(pruned_f, current.g + 1 + h(n));
+                    continue;
                 }
+                OPEN.emplace_back(n.first, n.second, current.g + 1, h(n));
+                std::push_heap(OPEN.begin(), OPEN.end(), std::greater<PlannerNode>());
+                closed[c] = search_stamp;
+                parents[c] = parent;
             }
         }
     }
     void reset()
     {
-        CLOSED.clear();
-        OPEN = std::priority_queue<PlannerNode, std::vector<PlannerNode>, std::greater<PlannerNode>>();
+        if(++search_stamp == 0)
+        {
+            std::fill(closed.begin(), closed.end(), 0);
+            search_stamp = 1;
+        }
+        OPEN.clear();
+        pruned_f = INF;
         PlannerNode s = PlannerNode(start.first, start.second, 0, h(start));
-        OPEN.push(s);
+        OPEN.push_back(s);
         best_node = s;
     }
+    bool reached(std::pair<int, int> n) const
+    {
+        return in_map(n) and closed[cell(n)] == search_stamp;
+    }
+    void extract_plan()
+    {
+        plan.clear();
+        plan_start = 0;
+        plan_reaches_goal = reached(goal);
+        const int target = plan_reaches_goal ? cell(goal) : cell({best_node.i, best_node.j});
+        for(int c = target; c != cell(start); c = parents[c])
+            plan.push_back(c);
+        plan.push_back(cell(start));
+        std::reverse(plan.begin(), plan.end());
+        // No agent was skipped below the plan's cost, so the plan is a shortest path
+        // around static obstacles, and so is every suffix of it while it stays free.
+        plan_is_shortest = pruned_f >= static_cast<int>(plan.size()) - 1;
+    }
+    bool reuse_plan(std::pair<int, int> s, std::pair<int, int> g)
+    {
+        if(!reuse_paths or !plan_reaches_goal or !plan_is_shortest or g != goal)
+            return false;
+        size_t k = plan_start;
+        while(k < plan.size() and plan[k] != cell(s))
+            k++;
+        if(k == plan.size())
+            return false;
+        for(size_t m = k + 1; m < plan.size(); m++)
+            if(obstacles[plan[m]] or other_agents[plan[m]] == agents_stamp)
+                return false;
+        plan_start = k;
+        start = s;
+        return true;
+    }
+    std::pair<int, int> plan_target(bool use_best_node) const
+    {
+        if(plan.empty() or !(plan_reaches_goal or use_best_node))
+            return {INF, INF};
+        return position(plan.back());
+    }
 public:
-    planner(int steps=10000) {max_steps = steps;}
-    void update_obstacles(const std::list<std::pair<int, int>>& _obstacles,
-                          const std::list<std::pair<int, int>>& _other_agents,
+    planner(int steps=10000, bool reuse_paths_=true) {max_steps = steps; reuse_paths = reuse_paths_;}
+    void set_map_size(int height_, int width_)
+    {
+        if(height_ == height and width_ == width)
+            return;
+        std::vector<uint8_t> known(height_ * width_, 0);
+        std::vector<uint32_t> agents(height_ * width_, 0);
+        for(int i = 0; i < std::min(height, height_); i++)
+            for(int j = 0; j < std::min(width, width_); j++)
+            {
+                known[i * width_ + j] = obstacles[i * width + j];
+                agents[i * width_ + j] = other_agents[i * width + j];
+            }
+        height = height_;
+        width = width_;
+        obstacles.swap(known);
+        other_agents.swap(agents);
+        closed.assign(height * width, 0);
+        parents.assign(height * width, -1);
+        search_stamp = 0;
+        plan.clear();
+        plan_reaches_goal = false;
+    }
+    // Uses exact distances to the goal (row-major, height_ x width_) as the
+    // heuristic instead of Manhattan distance; nullptr switches back.
+    void set_goal_distances(const uint16_t* distances, int height_, int width_)
+    {
+        goal_distances = distances;
+        distances_height = height_;
+        distances_width = width_;
+        plan.clear();
+        plan_reaches_goal = false;
+    }
+    // Forgets the last move and the moves that failed, but keeps the known obstacles.
+    void reset_plan()
+    {
+        desired_position = {INF, INF};
+        bad_actions.clear();
+    }
+    void update_obstacles(const std::vector<std::pair<int, int>>& _obstacles,
+                          const std::vector<std::pair<int, int>>& _other_agents,
                           std::pair<int, int> cur_pos)
     {
         for(auto o:_obstacles)
-            obstacles.insert({cur_pos.first + o.first, cur_pos.second + o.second});
-        other_agents.clear();
+        {
+            const std::pair<int, int> n(cur_pos.first + o.first, cur_pos.second + o.second);
+            ensure_size(n);
+            if(in_map(n))
+                obstacles[cell(n)] = 1;
+        }
+        if(++agents_stamp == 0)
+        {
+            std::fill(other_agents.begin(), other_agents.end(), 0);
+            agents_stamp = 1;
+        }
         for(auto o:_other_agents)
-            other_agents.insert({cur_pos.first + o.first, cur_pos.second + o.second});
+        {
+            const std::pair<int, int> n(cur_pos.first + o.first, cur_pos.second + o.second);
+            ensure_size(n);
+            if(in_map(n))
+                other_agents[cell(n)] = agents_stamp;
+        }
     }
     void update_path(std::pair<int, int> s, std::pair<int, int> g)
     {
+        ensure_size(s);
+        ensure_size(g);
         if(desired_position.first < INF and (desired_position.first != s.first or desired_position.second != s.second)) {
-            bad_actions.insert(desired_position);
+            if(std::find(bad_actions.begin(), bad_actions.end(), desired_position) == bad_actions.end())
+                bad_actions.push_back(desired_position);
             if (start.first == s.first and start.second == s.second)
                 for (auto bad_a: bad_actions)
-                    other_agents.insert(bad_a);
+                    if(in_map(bad_a))
+                        other_agents[cell(bad_a)] = agents_stamp;
         }
         else
             bad_actions.clear();
+        if(reuse_plan(s, g))
+            return;
         start = s;
         goal = g;
         reset();
         compute_shortest_path();
+        extract_plan();
     }
     std::list<std::pair<int, int>> get_path(bool use_best_node = true)
     {
         std::list<std::pair<int, int>> path;
-        std::pair<int, int> next_node(INF,INF);
-        if(CLOSED.find(goal) != CLOSED.end())
-            next_node = goal;
-        else if(use_best_node)
-            next_node = {best_node.i, best_node.j};
-        if(next_node.first < INF and (next_node.first != start.first or next_node.second != start.second))
+        std::pair<int, int> next_node = plan_target(use_best_node);
+        if(next_node.first < INF and plan.size() - plan_start > 1)
         {
-            while (CLOSED[next_node] != start) {
-                path.push_back(next_node);
-                next_node = CLOSED[next_node];
-            }
-            path.push_back(next_node);
-            path.push_back(start);
-            path.reverse();
+            for(size_t k = plan_start; k < plan.size(); k++)
+                path.push_back(position(plan[k]));
+            next_node = position(plan[plan_start + 1]);
         }
         desired_position = next_node;
         return path;
@@ -147,15 +286,8 @@ public:
     std::pair<std::pair<int, int>, std::pair<int, int>> get_next_node(bool use_best_node = true)
     {
         std::pair<int, int> next_node(INF, INF);
-        if(CLOSED.find(goal) != CLOSED.end())
-            next_node = goal;
-        else if(use_best_node)
-            next_node = {best_node.i, best_node.j};
-        if(next_node.first < INF and (next_node.first != start.first or next_node.second != start.second))
-            while (CLOSED[next_node] != start)
-                next_node = CLOSED[next_node];
-        if(next_node == start)
-            next_node = {INF, INF};
+        if(plan_target(use_best_node).first < INF and plan.size() - plan_start > 1)
+            next_node = position(plan[plan_start + 1]);
         desired_position = next_node;
         return {start, next_node};
     }
@@ -164,7 +296,10 @@ public:
 PYBIND11_MODULE(planner, m) {
     py::class_<planner>(m, "planner")
             .def(py::init<int>())
+            .def(py::init<int, bool>())
+            .def("set_map_size", &planner::set_map_size)
             .def("update_obstacles", &planner::update_obstacles)
+            .def("reset_plan", &planner::reset_plan)
             .def("update_path", &planner::update_path)
             .def("get_path", &planner::get_path)
             .def("get_next_node", &planner::get_next_node);
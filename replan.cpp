@@ -4,12 +4,13 @@
 #include <pybind11/stl_bind.h>
 #include "planner.cpp"
 #include "environment.cpp"
+#include "distance_fields.hpp"
 #include <mutex>
 #include <deque>
 #include <utility>
 #include <functional>
 #include <algorithm>
-#include <list>
+#include <array>
 namespace py = pybind11;
 
 class RePlan
@@ -26,8 +27,25 @@ class RePlan
     bool ignore_other_agents = false;
     std::vector<planner> planners;
     std::vector<std::vector<std::pair<int, int>>> previous_positions;
+    // scratch buffers of act(), cleared per call so that steps allocate nothing
+    std::vector<int> actions;
+    std::vector<std::pair<int, int>> visible_obstacles;
+    std::vector<std::pair<int, int>> visible_agents;
     std::default_random_engine engine;
     Environment env;
+    const DistanceFieldCache* distance_fields = nullptr;
+
+    void attach_distance_fields()
+    {
+        for(size_t i = 0; i < planners.size() && i < env.goals.size(); i++)
+        {
+            const uint16_t* field = distance_fields ? distance_fields->get(env.goals[i]) : nullptr;
+            if(field)
+                planners[i].set_goal_distances(field, distance_fields->get_height(), distance_fields->get_width());
+            else
+                planners[i].set_goal_distances(nullptr, 0, 0);
+        }
+    }
 
 public:
 
@@ -58,20 +76,24 @@ public:
         {
             previous_positions.push_back({});
         }
+        actions.reserve(num_agents);
+        visible_obstacles.reserve((2 * obs_radius + 1) * (2 * obs_radius + 1));
+        visible_agents.reserve(num_agents);
     }
 
     int _get_random_move(const int agent_idx, const Environment& env)
     {
         if(seed < 0)
             engine.seed(std::chrono::system_clock::now().time_since_epoch().count());
-        std::vector<int> to_shuffle = {1, 2, 3, 4};
+        std::array<int, 4> to_shuffle = {1, 2, 3, 4};
         std::shuffle(std::begin(to_shuffle), std::end(to_shuffle), engine);
         return to_shuffle[0];
     }
 
-    std::vector<int> act()
+    // The actions stay valid until the next call.
+    const std::vector<int>& act()
     {
-        std::vector<int> actions;
+        actions.clear();
         for(int i = 0; i < num_agents; i++)
         {
             if (previous_positions.size() == 0)
@@ -90,7 +112,7 @@ public:
             }
             else
             {
-                std::list<std::pair<int, int>> visible_obstacles;
+                visible_obstacles.clear();
                 for(int m = env.cur_positions[i].first - obs_radius; m <= env.cur_positions[i].first + obs_radius; m++) // absence of oob guaranteed by pogema
                 {
                     for(int n = env.cur_positions[i].second - obs_radius; n <= env.cur_positions[i].second + obs_radius; n++)
@@ -101,7 +123,7 @@ public:
                         }
                     }
                 }
-                std::list<std::pair<int, int>> visible_agents;
+                visible_agents.clear();
                 if (!ignore_other_agents)
                 {
                     for (int j = 0; j < num_agents; j++)
@@ -143,7 +165,7 @@ public:
         {
             for(int i = 0; i < num_agents; i++)
             {
-                auto path = previous_positions[i];
+                const auto& path = previous_positions[i];
                 if (path.size() > 1)
                 {
                     auto cur_pos = env.cur_positions[i];
@@ -168,13 +190,42 @@ public:
                 }
             }
         }
-        env.step(actions);
+        env.step(actions, false);
         return actions;
     }
 
     void set_env(const Environment& env_)
     {
         env = env_;
+        for(auto& p: planners)
+        {
+            p.set_map_size(env.height, env.width);
+        }
+        attach_distance_fields();
+    }
+
+    // Plans with exact goal distances from fields, which must outlive this
+    // policy and hold the goals of the environment; nullptr restores Manhattan.
+    void set_distance_fields(const DistanceFieldCache* fields)
+    {
+        distance_fields = fields;
+        attach_distance_fields();
+    }
+
+    // Restarts the policy from the agent state of env_, which must share the map
+    // given to set_env(). Planners keep the obstacles they have already seen.
+    void reset(const Environment& env_)
+    {
+        env.copy_state_from(env_);
+        for(auto& positions: previous_positions)
+        {
+            positions.clear();
+        }
+        for(auto& p: planners)
+        {
+            p.reset_plan();
+        }
+        steps = 0;
     }
 };
 
@@ -184,6 +235,7 @@ PYBIND11_MODULE(replan, m) {
             .def("act", &RePlan::act)
             .def("init", &RePlan::init)
             .def("set_env", &RePlan::set_env)
+            .def("reset", &RePlan::reset)
             ;
 }
 
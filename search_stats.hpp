@@ -0,0 +1,86 @@
+#pragma once
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <vector>
+
+enum SearchPhase
+{
+    phase_selection,
+    phase_expansion,
+    phase_rollout,
+    phase_backup,
+    num_phases
+};
+
+constexpr int max_tracked_depth = 64;
+
+// Counters and phase timers of one search thread. A thread reads the clock only
+// at phase boundaries: mark() charges the time since the previous boundary to
+// the phase that just ended.
+struct alignas(64) ThreadStats
+{
+    std::chrono::steady_clock::time_point last;
+    std::array<uint64_t, num_phases> phase_ns{};
+    uint64_t iterations = 0;
+    uint64_t rollouts = 0;
+    uint64_t nodes_allocated = 0;
+    uint64_t insert_races = 0;
+    uint64_t tt_misses = 0;
+    // leaf depths below the root, the last bucket collects deeper leaves
+    std::array<uint64_t, max_tracked_depth + 1> depth_histogram{};
+
+    void start()
+    {
+        last = std::chrono::steady_clock::now();
+    }
+
+    void mark(const SearchPhase phase)
+    {
+        const auto now = std::chrono::steady_clock::now();
+        phase_ns[phase] += std::chrono::duration_cast<std::chrono::nanoseconds>(now - last).count();
+        last = now;
+    }
+
+    void record_depth(const int depth)
+    {
+        depth_histogram[depth < max_tracked_depth ? depth : max_tracked_depth]++;
+    }
+};
+
+// Totals over all search threads for the last act().
+struct SearchStats
+{
+    double act_ms = 0;
+    double selection_ms = 0;
+    double expansion_ms = 0;
+    double rollout_ms = 0;
+    double backup_ms = 0;
+    double pool_wait_ms = 0;
+    uint64_t pool_tasks = 0;
+    uint64_t iterations = 0;
+    uint64_t rollouts = 0;
+    uint64_t nodes_allocated = 0;
+    uint64_t insert_races = 0;
+    uint64_t tt_misses = 0;
+    uint64_t nodes_live = 0;
+    std::vector<uint64_t> depth_histogram;
+
+    void add(const ThreadStats& thread)
+    {
+        selection_ms += thread.phase_ns[phase_selection] * 1e-6;
+        expansion_ms += thread.phase_ns[phase_expansion] * 1e-6;
+        rollout_ms += thread.phase_ns[phase_rollout] * 1e-6;
+        backup_ms += thread.phase_ns[phase_backup] * 1e-6;
+        iterations += thread.iterations;
+        rollouts += thread.rollouts;
+        nodes_allocated += thread.nodes_allocated;
+        insert_races += thread.insert_races;
+        tt_misses += thread.tt_misses;
+        depth_histogram.resize(thread.depth_histogram.size());
+        for (size_t d = 0; d < thread.depth_histogram.size(); d++)
+        {
+            depth_histogram[d] += thread.depth_histogram[d];
+        }
+    }
+};
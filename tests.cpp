@@ -0,0 +1,330 @@
+#include "mcts.cpp"
+#include <atomic>
+#include <cstdlib>
+#include <cstdio>
+#include <exception>
+#include <functional>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Regression tests for the search. Every case throws on a failed check; the
+// binary runs all cases whose name contains the filter and fails if any did.
+// Usage: MCTS_tests [name filter]
+
+class TestSearch : public MonteCarloTreeSearch
+{
+public:
+    using MonteCarloTreeSearch::MonteCarloTreeSearch;
+    using MonteCarloTreeSearch::simulation;
+    using MonteCarloTreeSearch::search_env;
+};
+
+#define CHECK(condition) check((condition), #condition, __LINE__)
+
+void check(const bool ok, const char* condition, const int line)
+{
+    if (!ok)
+    {
+        throw std::runtime_error("line " + std::to_string(line) + ": " + condition);
+    }
+}
+
+#define CHECK_VALUE_ERROR(statement) check_value_error([&]() { statement; }, #statement, __LINE__)
+
+template<typename F>
+void check_value_error(F&& f, const char* statement, const int line)
+{
+    try
+    {
+        f();
+    }
+    catch (const py::value_error&)
+    {
+        return;
+    }
+    throw std::runtime_error("line " + std::to_string(line) + ": " + statement + " did not throw value_error");
+}
+
+Config test_config()
+{
+    Config cfg;
+    cfg.render = false;
+    cfg.seed = 1;
+    return cfg;
+}
+
+// Open height x width map with agents moving between the given cells.
+Environment open_map(const int height, const int width, const std::vector<std::pair<std::pair<int, int>, std::pair<int, int>>>& agents)
+{
+    Environment env;
+    env.create_grid(height, width);
+    for (const auto& agent : agents)
+    {
+        env.add_agent(agent.first.first, agent.first.second, agent.second.first, agent.second.second);
+    }
+    return env;
+}
+
+// Plays act() against a copy of the environment until all agents are done or
+// max_steps ran out, and returns the number of agents at their goals.
+int play(MonteCarloTreeSearch& mcts, Environment truth, const int max_steps)
+{
+    for (int t = 0; t < max_steps && !truth.all_done(); t++)
+    {
+        truth.step(mcts.act());
+    }
+    return truth.get_num_done();
+}
+
+// Every multi-simulation rollout must start from the caller's state: from a
+// state where all agents are done, no lane may collect any reward.
+void test_rollout_lanes_start_from_caller()
+{
+    TestSearch mcts(2);
+    Config cfg = test_config();
+    cfg.batch_size = 2;
+    cfg.multi_simulations = 4;
+    mcts.set_config(cfg);
+    mcts.set_env(open_map(1, 5, {{{0, 0}, {0, 2}}}), 2);
+    Environment& penv = mcts.search_env(1);
+    penv.step({4}, false);
+    penv.step({4}, false);
+    CHECK(penv.all_done());
+    for (int i = 0; i < 16; i++)
+    {
+        CHECK(mcts.simulation(1) == 0);
+    }
+    CHECK(penv.all_done());
+    CHECK(!mcts.search_env(0).all_done());
+}
+
+// Concurrent batch expansions with several rollouts each used to step the
+// same environments from different threads.
+void test_batch_with_multi_simulations()
+{
+    MonteCarloTreeSearch mcts(4);
+    Config cfg = test_config();
+    cfg.batch_size = 4;
+    cfg.multi_simulations = 3;
+    cfg.num_expansions = 200;
+    mcts.set_config(cfg);
+    const Environment env = open_map(6, 6, {{{0, 0}, {0, 3}}, {{5, 5}, {3, 5}}});
+    mcts.set_env(env, 2);
+    CHECK(play(mcts, env, 16) == 2);
+}
+
+// act_async() replaces the pending search while getters on another thread
+// wait on it and read the search state; every getter must see an idle search.
+void test_act_async_with_concurrent_getters()
+{
+    MonteCarloTreeSearch mcts(2);
+    Config cfg = test_config();
+    cfg.num_expansions = 50;
+    cfg.collect_stats = true;
+    mcts.set_config(cfg);
+    mcts.set_env(open_map(6, 6, {{{0, 0}, {5, 5}}, {{5, 0}, {0, 5}}}), 2);
+    std::atomic<bool> searching(true);
+    std::exception_ptr reader_error;
+    std::thread reader([&]()
+    {
+        try
+        {
+            while (searching)
+            {
+                CHECK(mcts.get_num_nodes() > 0);
+                CHECK(mcts.get_search_stats().iterations <= 2 * 50u);
+                CHECK(mcts.get_num_agents() == 2);
+            }
+        }
+        catch (...)
+        {
+            reader_error = std::current_exception();
+        }
+    });
+    std::vector<SearchFuture> searches;
+    for (int i = 0; i < 8; i++)
+    {
+        searches.push_back(mcts.act_async());
+    }
+    for (const auto& search : searches)
+    {
+        CHECK(search.result().size() == 2);
+    }
+    searching = false;
+    reader.join();
+    if (reader_error)
+    {
+        std::rethrow_exception(reader_error);
+    }
+}
+
+// Starts, goals and synced positions off the map or on obstacles are rejected
+// before they index the grids, and leave the environment as it was.
+void test_build_rejects_bad_cells()
+{
+    // 3x4 map with an obstacle at (1, 1)
+    const std::vector<uint8_t> obstacles = {0, 0, 0, 0,
+                                            0, 1, 0, 0,
+                                            0, 0, 0, 0};
+    const std::vector<int32_t> good = {0, 0};
+    Environment env;
+    env.build(obstacles.data(), 3, 4, good.data(), std::vector<int32_t>{2, 3}.data(), 1);
+    for (const auto& bad : std::vector<std::vector<int32_t>>{{3, 0}, {0, 4}, {-1, 0}, {0, -1}, {1, 1}})
+    {
+        CHECK_VALUE_ERROR(env.build(obstacles.data(), 3, 4, bad.data(), good.data(), 1));
+        CHECK_VALUE_ERROR(env.build(obstacles.data(), 3, 4, good.data(), bad.data(), 1));
+    }
+    CHECK(env.get_num_agents() == 1);
+    CHECK(env.cur_positions[0] == std::make_pair(0, 0));
+    CHECK(env.goals[0] == std::make_pair(2, 3));
+}
+
+void test_add_agent_rejects_bad_cells()
+{
+    Environment env;
+    env.create_grid(3, 4);
+    env.add_obstacle(1, 1);
+    CHECK_VALUE_ERROR(env.add_agent(-1, 0, 2, 3));
+    CHECK_VALUE_ERROR(env.add_agent(0, 4, 2, 3));
+    CHECK_VALUE_ERROR(env.add_agent(0, 0, 3, 3));
+    CHECK_VALUE_ERROR(env.add_agent(0, 0, 2, -1));
+    CHECK_VALUE_ERROR(env.add_agent(1, 1, 2, 3));
+    CHECK_VALUE_ERROR(env.add_obstacle(-1, 2));
+    CHECK(env.get_num_agents() == 0);
+
+    // agents added before the grid are checked when it is created
+    Environment early;
+    early.add_agent(0, 5, 0, 0);
+    CHECK_VALUE_ERROR(early.create_grid(3, 4));
+}
+
+void test_sync_positions_rejects_bad_cells()
+{
+    const Environment base = open_map(3, 4, {{{0, 0}, {2, 3}}, {{2, 0}, {0, 3}}});
+    Environment env = base;
+    env.add_obstacle(1, 1);
+    for (const auto& bad : std::vector<std::vector<int32_t>>{{0, 1, 3, 0}, {0, 1, 2, 4}, {-1, 0, 2, 0}, {0, 0, 2, -1}, {1, 1, 2, 0}})
+    {
+        CHECK_VALUE_ERROR(env.sync_positions(bad.data()));
+    }
+    CHECK(env.cur_positions[0] == std::make_pair(0, 0));
+    CHECK(env.cur_positions[1] == std::make_pair(2, 0));
+
+    MonteCarloTreeSearch mcts(1);
+    mcts.set_config(test_config());
+    mcts.set_env(base, 2);
+    CHECK_VALUE_ERROR(mcts.sync_positions(std::vector<int32_t>{0, 0, -1, 0}.data()));
+    CHECK(mcts.act().size() == 2);
+}
+
+// Once the transposition table is full every node probes it once, keeps
+// tt_full and is counted as a miss instead of probing again on every visit.
+void test_full_transposition_table()
+{
+    TranspositionTable table;
+    table.resize(1);
+    CHECK(table.find_or_insert(1) != tt_full);
+    CHECK(table.find_or_insert(2) != tt_full);
+    CHECK(table.find_or_insert(1) == table.find_or_insert(1));
+    CHECK(table.find_or_insert(3) == tt_full);
+    CHECK(table.get(tt_full) == nullptr);
+
+    MonteCarloTreeSearch mcts(1);
+    Config cfg = test_config();
+    cfg.use_transpositions = true;
+    cfg.transposition_table_log2 = 2;
+    cfg.collect_stats = true;
+    cfg.num_expansions = 200;
+    mcts.set_config(cfg);
+    const Environment env = open_map(6, 6, {{{0, 0}, {5, 5}}, {{5, 0}, {0, 5}}});
+    mcts.set_env(env, 2);
+    Environment truth = env;
+    uint64_t misses = 0, allocated = 0;
+    for (int t = 0; t < 8 && !truth.all_done(); t++)
+    {
+        truth.step(mcts.act());
+        misses += mcts.get_search_stats().tt_misses;
+        allocated += mcts.get_search_stats().nodes_allocated;
+    }
+    CHECK(misses > 0);
+    CHECK(misses <= allocated);
+}
+
+// The passes of step_random() keep the collision rules: no two active agents
+// of a lane share a cell, and every agent moves at most one cell per step.
+void test_lockstep_collisions()
+{
+    const Environment env = open_map(3, 3, {{{0, 0}, {2, 2}}, {{0, 2}, {2, 0}}, {{2, 0}, {0, 2}},
+                                            {{2, 2}, {0, 0}}, {{1, 1}, {1, 0}}, {{1, 2}, {0, 1}}});
+    for (const bool move_limits : {false, true})
+    {
+        EnvironmentBatch batch;
+        batch.seed(1);
+        for (int trial = 0; trial < 200; trial++)
+        {
+            batch.reset(env, 8);
+            std::vector<int32_t> before(batch.get_num_agents() * batch.get_lanes());
+            for (int step = 0; step < 16 && !batch.all_done(); step++)
+            {
+                for (size_t i = 0; i < batch.get_num_agents(); i++)
+                {
+                    for (size_t l = 0; l < batch.get_lanes(); l++)
+                    {
+                        before[i * batch.get_lanes() + l] = batch.cell(i, l);
+                    }
+                }
+                batch.step_random(5, move_limits, move_limits);
+                for (size_t l = 0; l < batch.get_lanes(); l++)
+                {
+                    std::vector<int> active(9, 0);
+                    for (size_t i = 0; i < batch.get_num_agents(); i++)
+                    {
+                        const int32_t from = before[i * batch.get_lanes() + l], to = batch.cell(i, l);
+                        CHECK(std::abs(from / 3 - to / 3) + std::abs(from % 3 - to % 3) <= 1);
+                        active[to] += !batch.reached_goal(i, l);
+                    }
+                    for (const int count : active)
+                    {
+                        CHECK(count <= 1);
+                    }
+                }
+            }
+        }
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    const std::string filter = argc > 1 ? argv[1] : "";
+    const std::vector<std::pair<std::string, std::function<void()>>> cases = {
+        {"rollout_lanes_start_from_caller", test_rollout_lanes_start_from_caller},
+        {"batch_with_multi_simulations", test_batch_with_multi_simulations},
+        {"act_async_with_concurrent_getters", test_act_async_with_concurrent_getters},
+        {"build_rejects_bad_cells", test_build_rejects_bad_cells},
+        {"add_agent_rejects_bad_cells", test_add_agent_rejects_bad_cells},
+        {"sync_positions_rejects_bad_cells", test_sync_positions_rejects_bad_cells},
+        {"full_transposition_table", test_full_transposition_table},
+        {"lockstep_collisions", test_lockstep_collisions},
+    };
+    int failed = 0;
+    for (const auto& test : cases)
+    {
+        if (test.first.find(filter) == std::string::npos)
+        {
+            continue;
+        }
+        try
+        {
+            test.second();
+            std::printf("PASS %s\n", test.first.c_str());
+        }
+        catch (const std::exception& e)
+        {
+            std::printf("FAIL %s: %s\n", test.first.c_str(), e.what());
+            failed++;
+        }
+    }
+    return failed > 0 ? 1 : 0;
+}
@@ -0,0 +1,91 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+// Visit statistics shared by every tree node that reaches the same joint
+// transition. key is 0 while the entry is free.
+struct TTEntry
+{
+    std::atomic<uint64_t> key;
+    std::atomic<uint32_t> cnt;
+    std::atomic<double> w;
+
+    void update(const double value)
+    {
+        double expected = w.load(std::memory_order_relaxed);
+        while (!w.compare_exchange_weak(expected, expected + value, std::memory_order_relaxed))
+        {
+        }
+        cnt.fetch_add(1, std::memory_order_relaxed);
+    }
+};
+
+// Index of a table entry plus one, 0 for none, so that nodes link to entries in
+// 32 bits. tt_full marks a node whose key found no free entry.
+using TTLink = uint32_t;
+constexpr TTLink tt_full = ~TTLink(0);
+
+// Fixed-size open-addressing table with linear probing. Entries are claimed by
+// a CAS on the key and never removed, so pointers to them stay valid until
+// clear(), which runs on set_env() and sync_positions(). When the probe window
+// is full find_or_insert() gives up and returns tt_full; the node keeps that
+// link, so it is not probed again, and uses its own statistics.
+class TranspositionTable
+{
+    static constexpr size_t max_probes = 16;
+
+    std::unique_ptr<TTEntry[]> entries;
+    size_t mask = 0;
+
+public:
+    // Allocates 2^log2_size entries (at most 2^31), or frees the table for
+    // log2_size < 0. Not thread-safe: call only while no search is running.
+    void resize(const int log2_size)
+    {
+        const size_t size = log2_size < 0 ? 0 : size_t(1) << std::min(log2_size, 31);
+        if (size != (entries ? mask + 1 : 0))
+        {
+            entries = size > 0 ? std::make_unique<TTEntry[]>(size) : nullptr;
+            mask = size > 0 ? size - 1 : 0;
+        }
+        clear();
+    }
+
+    void clear()
+    {
+        for (size_t i = 0; entries && i <= mask; i++)
+        {
+            entries[i].key.store(0, std::memory_order_relaxed);
+            entries[i].cnt.store(0, std::memory_order_relaxed);
+            entries[i].w.store(0, std::memory_order_relaxed);
+        }
+    }
+
+    TTEntry* get(const TTLink link) const
+    {
+        return link == 0 || link == tt_full ? nullptr : &entries[link - 1];
+    }
+
+    TTLink find_or_insert(uint64_t key)
+    {
+        if (!entries)
+        {
+            return tt_full;
+        }
+        key = key == 0 ? 1 : key;
+        for (size_t probe = 0; probe < max_probes; probe++)
+        {
+            const size_t index = (key + probe) & mask;
+            TTEntry& entry = entries[index];
+            uint64_t current = entry.key.load(std::memory_order_acquire);
+            if ((current == 0 && entry.key.compare_exchange_strong(current, key, std::memory_order_acq_rel)) || current == key)
+            {
+                return static_cast<TTLink>(index + 1);
+            }
+        }
+        return tt_full;
+    }
+};
@@ -0,0 +1,292 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Executor for search tasks. Every worker owns a bounded deque: it pushes and
+// pops at the back while idle workers steal from the front of the others.
+// parallel_for() posts one task per index that points at the caller's functor,
+// so submitting allocates nothing, and the calling thread keeps executing tasks
+// until its own are finished, which makes nested parallel_for() calls safe.
+// With set_timing(true) posted tasks are timestamped and the time they spend
+// queued is summed up until take_wait_ns() collects it.
+class WorkStealingPool
+{
+    struct TaskGroup
+    {
+        std::atomic<int> pending;
+        std::mutex error_mutex;
+        std::exception_ptr error;
+    };
+
+    struct Task
+    {
+        void (*run)(const void* fn, int index);
+        const void* fn;
+        int index;
+        TaskGroup* group;
+        int64_t posted_ns;
+    };
+
+    struct alignas(64) Queue
+    {
+        static constexpr size_t capacity = 1024;
+        std::mutex mutex;
+        Task tasks[capacity];
+        size_t head = 0;
+        size_t tail = 0;
+
+        bool push_back(const Task& task)
+        {
+            const std::lock_guard<std::mutex> lock(mutex);
+            if (tail - head == capacity)
+            {
+                return false;
+            }
+            tasks[tail++ % capacity] = task;
+            return true;
+        }
+
+        bool pop_back(Task& task)
+        {
+            const std::lock_guard<std::mutex> lock(mutex);
+            if (tail == head)
+            {
+                return false;
+            }
+            task = tasks[--tail % capacity];
+            return true;
+        }
+
+        bool pop_front(Task& task)
+        {
+            const std::lock_guard<std::mutex> lock(mutex);
+            if (tail == head)
+            {
+                return false;
+            }
+            task = tasks[head++ % capacity];
+            return true;
+        }
+    };
+
+    std::vector<std::unique_ptr<Queue>> queues;
+    std::vector<std::thread> threads;
+    std::atomic<int> num_queued = 0;
+    std::atomic<unsigned> next_queue = 0;
+    std::atomic<bool> stopping = false;
+    std::atomic<bool> timing = false;
+    std::atomic<uint64_t> wait_ns = 0;
+    std::atomic<uint64_t> waited_tasks = 0;
+    std::mutex sleep_mutex;
+    std::condition_variable wake;
+
+    static inline thread_local const WorkStealingPool* current_pool = nullptr;
+    static inline thread_local int current_worker = -1;
+
+    template<typename F>
+    static void invoke(const void* fn, const int index)
+    {
+        (*static_cast<const F*>(fn))(index);
+    }
+
+    static int64_t now_ns()
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    void execute(const Task& task)
+    {
+        if (task.posted_ns != 0)
+        {
+            wait_ns.fetch_add(now_ns() - task.posted_ns, std::memory_order_relaxed);
+            waited_tasks.fetch_add(1, std::memory_order_relaxed);
+        }
+        try
+        {
+            task.run(task.fn, task.index);
+        }
+        catch (...)
+        {
+            const std::lock_guard<std::mutex> lock(task.group->error_mutex);
+            if (!task.group->error)
+            {
+                task.group->error = std::current_exception();
+            }
+        }
+        task.group->pending.fetch_sub(1, std::memory_order_acq_rel);
+    }
+
+    int worker_index() const
+    {
+        return current_pool == this ? current_worker : -1;
+    }
+
+    bool try_take(const int self, Task& task)
+    {
+        if (num_queued.load(std::memory_order_acquire) == 0)
+        {
+            return false;
+        }
+        const int num_queues = static_cast<int>(queues.size());
+        if (self >= 0 && queues[self]->pop_back(task))
+        {
+            num_queued.fetch_sub(1, std::memory_order_acq_rel);
+            return true;
+        }
+        const int start = self >= 0 ? self + 1 : static_cast<int>(next_queue.load(std::memory_order_relaxed));
+        for (int k = 0; k < num_queues; k++)
+        {
+            const int victim = (start + k) % num_queues;
+            if (victim != self && queues[victim]->pop_front(task))
+            {
+                num_queued.fetch_sub(1, std::memory_order_acq_rel);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void post(const int self, Task task)
+    {
+        if (timing.load(std::memory_order_relaxed))
+        {
+            task.posted_ns = now_ns();
+        }
+        const int target = self >= 0 ? self : static_cast<int>(next_queue.fetch_add(1, std::memory_order_relaxed) % queues.size());
+        num_queued.fetch_add(1, std::memory_order_acq_rel);
+        if (!queues[target]->push_back(task))
+        {
+            num_queued.fetch_sub(1, std::memory_order_acq_rel);
+            task.posted_ns = 0;
+            execute(task);
+        }
+    }
+
+    void notify()
+    {
+        {
+            const std::lock_guard<std::mutex> lock(sleep_mutex);
+        }
+        wake.notify_all();
+    }
+
+    void worker(const int self)
+    {
+        current_pool = this;
+        current_worker = self;
+        Task task;
+        while (true)
+        {
+            if (try_take(self, task))
+            {
+                execute(task);
+                continue;
+            }
+            std::unique_lock<std::mutex> lock(sleep_mutex);
+            wake.wait(lock, [this] { return stopping.load() || num_queued.load() > 0; });
+            if (stopping.load() && num_queued.load() == 0)
+            {
+                return;
+            }
+        }
+    }
+
+public:
+    explicit WorkStealingPool(const unsigned num_threads = std::thread::hardware_concurrency())
+    {
+        for (unsigned i = 0; i < num_threads; i++)
+        {
+            queues.push_back(std::make_unique<Queue>());
+        }
+        for (unsigned i = 0; i < num_threads; i++)
+        {
+            threads.emplace_back(&WorkStealingPool::worker, this, static_cast<int>(i));
+        }
+    }
+
+    WorkStealingPool(const WorkStealingPool&) = delete;
+    WorkStealingPool& operator=(const WorkStealingPool&) = delete;
+
+    ~WorkStealingPool()
+    {
+        stopping = true;
+        notify();
+        for (auto& thread : threads)
+        {
+            thread.join();
+        }
+    }
+
+    size_t get_thread_count() const
+    {
+        return threads.size();
+    }
+
+    void set_timing(const bool enabled)
+    {
+        timing.store(enabled, std::memory_order_relaxed);
+    }
+
+    // Total queue wait of the tasks executed since the last call, in nanoseconds.
+    uint64_t take_wait_ns()
+    {
+        return wait_ns.exchange(0, std::memory_order_relaxed);
+    }
+
+    uint64_t take_waited_tasks()
+    {
+        return waited_tasks.exchange(0, std::memory_order_relaxed);
+    }
+
+    // Runs f(0), ..., f(n - 1) and returns once all of them have finished,
+    // rethrowing the first exception thrown by any of them.
+    template<typename F>
+    void parallel_for(const int n, const F& f)
+    {
+        if (n <= 0)
+        {
+            return;
+        }
+        if (n == 1 || threads.empty())
+        {
+            for (int i = 0; i < n; i++)
+            {
+                f(i);
+            }
+            return;
+        }
+        TaskGroup group;
+        group.pending = n;
+        const int self = worker_index();
+        for (int i = 1; i < n; i++)
+        {
+            post(self, Task{&invoke<F>, &f, i, &group, 0});
+        }
+        notify();
+        execute(Task{&invoke<F>, &f, 0, &group, 0});
+        Task task;
+        while (group.pending.load(std::memory_order_acquire) > 0)
+        {
+            if (try_take(self, task))
+            {
+                execute(task);
+            }
+            else
+            {
+                std::this_thread::yield();
+            }
+        }
+        if (group.error)
+        {
+            std::rethrow_exception(group.error);
+        }
+    }
+};
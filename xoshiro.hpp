@@ -0,0 +1,144 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+// splitmix64 finalizer of x + golden ratio: a cheap, well-mixed hash of an
+// integer, also used to expand seeds.
+inline uint64_t splitmix64(uint64_t x)
+{
+    x += 0x9e3779b97f4a7c15ULL;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+}
+
+// xoshiro256** by Blackman and Vigna. jump() advances the state by 2^128 draws,
+// so one seed splits into non-overlapping streams, one per environment copy.
+class Xoshiro256
+{
+    uint64_t s[4];
+
+    static uint64_t rotl(const uint64_t x, const int k)
+    {
+        return (x << k) | (x >> (64 - k));
+    }
+
+public:
+    using result_type = uint64_t;
+
+    explicit Xoshiro256(const uint64_t seed_ = 0)
+    {
+        seed(seed_);
+    }
+
+    static constexpr result_type min()
+    {
+        return 0;
+    }
+
+    static constexpr result_type max()
+    {
+        return std::numeric_limits<result_type>::max();
+    }
+
+    void seed(uint64_t x)
+    {
+        for (auto& word : s)
+        {
+            word = splitmix64(x);
+            x += 0x9e3779b97f4a7c15ULL;
+        }
+    }
+
+    result_type operator()()
+    {
+        const uint64_t result = rotl(s[1] * 5, 7) * 9;
+        const uint64_t t = s[1] << 17;
+        s[2] ^= s[0];
+        s[3] ^= s[1];
+        s[1] ^= s[2];
+        s[0] ^= s[3];
+        s[2] ^= t;
+        s[3] = rotl(s[3], 45);
+        return result;
+    }
+
+    // Uniform integer in [0, n) by Lemire's multiply-shift, without division.
+    uint32_t bounded(const uint32_t n)
+    {
+        return static_cast<uint32_t>(((*this)() >> 32) * n >> 32);
+    }
+
+    void jump()
+    {
+        static constexpr uint64_t jump_poly[] = {0x180ec6d33cfd0abaULL, 0xd5a61266f0c9392cULL, 0xa9582618e03fc9aaULL, 0x39abdc4529b1661cULL};
+        uint64_t t[4] = {0, 0, 0, 0};
+        for (const auto poly : jump_poly)
+        {
+            for (int b = 0; b < 64; b++)
+            {
+                if (poly & (uint64_t(1) << b))
+                {
+                    for (int k = 0; k < 4; k++)
+                    {
+                        t[k] ^= s[k];
+                    }
+                }
+                (*this)();
+            }
+        }
+        for (int k = 0; k < 4; k++)
+        {
+            s[k] = t[k];
+        }
+    }
+};
+
+// Independent xoshiro256** streams stored as structure of arrays, so that
+// next() draws one number from every stream in a loop that vectorizes.
+class Xoshiro256Streams
+{
+    std::vector<uint64_t> s0, s1, s2, s3;
+
+public:
+    // Seeds num_streams streams from the output of engine.
+    void seed(Xoshiro256& engine, const size_t num_streams)
+    {
+        for (auto* s : {&s0, &s1, &s2, &s3})
+        {
+            s->resize(num_streams);
+            for (auto& word : *s)
+            {
+                word = engine();
+            }
+        }
+    }
+
+    size_t size() const
+    {
+        return s0.size();
+    }
+
+    // Writes the upper 32 bits of the next draw of every stream to out.
+    void next(uint32_t* out)
+    {
+        uint64_t* a = s0.data();
+        uint64_t* b = s1.data();
+        uint64_t* c = s2.data();
+        uint64_t* d = s3.data();
+        for (size_t k = 0; k < s0.size(); k++)
+        {
+            const uint64_t x = b[k] * 5;
+            out[k] = static_cast<uint32_t>((((x << 7) | (x >> 57)) * 9) >> 32);
+            const uint64_t t = b[k] << 17;
+            c[k] ^= a[k];
+            d[k] ^= b[k];
+            b[k] ^= c[k];
+            a[k] ^= d[k];
+            c[k] ^= t;
+            d[k] = (d[k] << 45) | (d[k] >> 19);
+        }
+    }
+};